@@ -0,0 +1,101 @@
+#include "encoder.h"
+#include <map>
+using namespace std;
+
+/**
+* Encodes an R-type instruction.
+*
+* @param op - The opcode (0 for every R-type instruction)
+* @param s - The first source register
+* @param t - The second source register
+* @param d - The destination register
+* @param func - The function code
+*
+* @return The 32 bit instruction word
+*/
+int64_t encodeRegister(int64_t op, int64_t s, int64_t t, int64_t d, int64_t func) {
+    return ((op << 26) | (s << 21) | (t << 16) | (d << 11) | func) & 0xffffffff;
+}
+
+/**
+* Encodes an I-type instruction. Negative immediates are stored in two's complement.
+*
+* @param op - The opcode
+* @param s - The s register
+* @param t - The t register
+* @param i - The 16 bit immediate
+*
+* @return The 32 bit instruction word
+*/
+int64_t encodeImmediate(int64_t op, int64_t s, int64_t t, int64_t i) {
+    return ((op << 26) | (s << 21) | (t << 16) | (i & 0xffff)) & 0xffffffff;
+}
+
+// How the operands of each mnemonic, in assembly order, are placed in the instruction.
+enum Format { DST, ST, D, S, STI, TIS };
+
+struct Encoding {
+    Format format;
+    int64_t code;
+};
+
+static const map<string, Encoding> &encodings() {
+    static const map<string, Encoding> table = {
+        {"add", {DST, 32}}, {"sub", {DST, 34}}, {"slt", {DST, 42}}, {"sltu", {DST, 43}},
+        {"mult", {ST, 24}}, {"multu", {ST, 25}}, {"div", {ST, 26}}, {"divu", {ST, 27}},
+        {"mfhi", {D, 16}}, {"mflo", {D, 18}}, {"lis", {D, 20}},
+        {"jr", {S, 8}}, {"jalr", {S, 9}},
+        {"beq", {STI, 4}}, {"bne", {STI, 5}},
+        {"lw", {TIS, 35}}, {"sw", {TIS, 43}},
+    };
+    return table;
+}
+
+/**
+* Checks if a mnemonic is an instruction the encoder knows.
+*
+* @param mnemonic - The mnemonic
+*
+* @return true if encodeInstruction accepts it
+*/
+bool isMnemonic(string mnemonic) { return encodings().count(mnemonic) > 0; }
+
+/**
+* Encodes an instruction from its mnemonic and its operands in the order they are written in
+* assembly, e.g. "lw $3, -4($30)" is encodeInstruction("lw", {3, -4, 30}). Branch offsets must
+* already be resolved to a number of words.
+*
+* @param mnemonic - The mnemonic
+* @param operands - The register numbers and immediates
+*
+* @return The 32 bit instruction word
+*/
+int64_t encodeInstruction(string mnemonic, vector<int64_t> operands) {
+    Encoding encoding = encodings().at(mnemonic);
+    switch(encoding.format) {
+        case DST: return encodeRegister(0, operands[1], operands[2], operands[0], encoding.code);
+        case ST: return encodeRegister(0, operands[0], operands[1], 0, encoding.code);
+        case D: return encodeRegister(0, 0, 0, operands[0], encoding.code);
+        case S: return encodeRegister(0, operands[0], 0, 0, encoding.code);
+        case STI: return encodeImmediate(encoding.code, operands[0], operands[1], operands[2]);
+        case TIS: return encodeImmediate(encoding.code, operands[2], operands[0], operands[1]);
+    }
+    return 0;
+}
+
+/**
+* Writes a word in big-endian byte order.
+*
+* @param out - The stream to write to
+* @param word - The word
+*/
+void printWord(ostream &out, int64_t word) {
+    unsigned char c = word >> 24;
+    out << c;
+    c = word >> 16;
+    out << c;
+    c = word >> 8;
+    out << c;
+    c = word;
+    out << c;
+}
@@ -0,0 +1,20 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Machine-code encoders for the MIPS instructions used in CS 241, shared by the assembler and
+// the code generator's binary output.
+
+int64_t encodeRegister(int64_t op, int64_t s, int64_t t, int64_t d, int64_t func);
+
+int64_t encodeImmediate(int64_t op, int64_t s, int64_t t, int64_t i);
+
+int64_t encodeInstruction(std::string mnemonic, std::vector<int64_t> operands);
+
+bool isMnemonic(std::string mnemonic);
+
+void printWord(std::ostream &out, int64_t word);
+
+#endif
@@ -1,5 +1,6 @@
 #include "asm.h"
 #include "utility.h"
+#include "encoder.h"
 #include <cstring>
 using namespace std;
 
@@ -15,53 +16,6 @@ using namespace std;
 //       9:  WHITESPACE,
 //       10: COMMENT
 
-void printBinaryEight(int64_t n) {
-    unsigned char c = n >> 8;
-    cout << c;
-}
-
-void printArgsBinary(int64_t op, int64_t s, int64_t t, int64_t d, int64_t func) {
-    int instr = (op<<26) | (s<<21) | (t<<16) | (d<<11) | func; // add $3, $2, $4
-    unsigned char c = instr >> 24;
-    cout << c;
-    c = instr >> 16;
-    cout << c;
-    c = instr >> 8;
-    cout << c;
-    c = instr >> 0;
-    cout << c;
-
-}
-
-void printBranchLabel(int64_t op, int64_t s, int64_t t, int64_t i) {
-    // int instr =  (op<<26) | (s<<21) | (t<<16) | (i<<0); // add $3, $2, $4
-    int instr =  (op<<26) | (s<<21) | (t<<16) | i; // add $3, $2, $4
-    unsigned char c = instr >> 24;
-    cout << c;
-    c = instr >> 16;
-    cout << c;
-    c = instr >> 8;
-    cout << c;
-    c = instr << 0;
-    cout << c;
-}
-
-void printBranchBinary(int64_t op, int64_t s, int64_t t, int64_t i) {
-    int instr = (op<<26) | (s<<21) | (t<<16) | i;
-    if(i < 0) {
-        instr = (op<<26) | (s<<21) | (t<<16) | (i & 0xffff);
-    }
-     // add $3, $2, $4
-    unsigned char c = instr >> 24;
-    cout << c;
-    c = instr >> 16;
-    cout << c;
-    c = instr >> 8;
-    cout << c;
-    c = instr >> 0;
-    cout << c;
-}
-
 void printLabels(vector<int> address, vector<string> labels) {
     int n = labels.size();
 
@@ -298,118 +252,32 @@ int main() {
                     i += 1;
                 }
 
-                else if(lex == "jr") {
-                    printArgsBinary(0, fakeTokenLine[i+1].toNumber(), 0, 0, 8);
-                    ++i;
-                }
-                else if(lex == "jalr") {
-                    printArgsBinary(0, fakeTokenLine[i+1].toNumber(), 0, 0, 9);
-                    ++i;
-                }
-                else if(lex == "slt") {
-                    printArgsBinary(0, fakeTokenLine[i+3].toNumber(), fakeTokenLine[i+5].toNumber(), 
-                    fakeTokenLine[i+1].toNumber(), 42);
-                    i += 5;
-                }
-                else if(lex == "sltu") {
-                    printArgsBinary(0, fakeTokenLine[i+3].toNumber(), fakeTokenLine[i+5].toNumber(), 
-                    fakeTokenLine[i+1].toNumber(), 43);
-                    i += 5;
-                }
-                else if(lex == "add") {
-                    printArgsBinary(0, fakeTokenLine[i+3].toNumber(), fakeTokenLine[i+5].toNumber(), 
-                    fakeTokenLine[i+1].toNumber(), 32);
-                    i += 5;
-                }
-                else if(lex == "sub") {
-                    printArgsBinary(0, fakeTokenLine[i+3].toNumber(), fakeTokenLine[i+5].toNumber(), 
-                    fakeTokenLine[i+1].toNumber(), 34);
-                    i += 5;
-                }
-                else if(lex == "beq" && what != 1) {
-                    if(fakeTokenLine[i+5].getKind() == 0) { // label
-                        int index = getLabel(labels, fakeTokenLine[i+5].getLexeme());
-                        int labelValue = address[index];
-                        int offset = 0;
-                        offset = (labelValue - (numline * 4)) / 4;
-                        // cout << offset << endl;
-                        // cout << "index: " << offset << endl;
-
-                        printBranchBinary(4, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                           offset);
-                        // printBranchBinary(4, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                        //    offset);
-                    }
-
-                    else {
-                        printBranchBinary(4, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                          fakeTokenLine[i+5].toNumber());
-                    }
-                    i += 5;
-                }
-                else if(lex == "bne" && what != 1) {
+                else if(lex == "beq" || lex == "bne") {
                     // (labelValue-PC)/4
-
-                    if(fakeTokenLine[i+5].getKind() == 0) {
+                    int64_t offset = fakeTokenLine[i+5].toNumber();
+                    if(fakeTokenLine[i+5].getKind() == 0) { // label
                         int index = getLabel(labels, fakeTokenLine[i+5].getLexeme());
                         int labelValue = address[index];
-                        int offset = 0;
-                        offset = (labelValue - (numline * 4)) / 4;
-
-                        printBranchBinary(5, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                           offset);
-                        // printBranchBinary(4, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                        //    offset);
-                    }
-
-                    else {
-                        printBranchBinary(5, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                          fakeTokenLine[i+5].toNumber());
+                        offset = (labelValue - (numline + 1) * 4) / 4;
                     }
+                    printBinary(encodeInstruction(lex, {fakeTokenLine[i+1].toNumber(),
+                        fakeTokenLine[i+3].toNumber(), offset}));
                     i += 5;
                 }
-                else if(lex == "lis") {
-                    printArgsBinary(0, 0, 0, fakeTokenLine[i+1].toNumber(), 20);
-                    ++i;
-                }
-                else if(lex == "mflo") {
-                    printArgsBinary(0, 0, 0, fakeTokenLine[i+1].toNumber(), 18);
-                    ++i;
-                }
-                else if(lex == "mfhi") {
-                    printArgsBinary(0, 0, 0, fakeTokenLine[i+1].toNumber(), 16);
-                    ++i;
-                }
-                else if(lex == "mult") {
-                    printArgsBinary(0, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                    0, 24);
-                    i += 3;
-                }
-                else if(lex == "multu") {
-                    printArgsBinary(0, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                    0, 25);
-                    i += 3;
-                }
-                else if(lex == "div") {
-                    printArgsBinary(0, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                    0, 26);
-                    i += 3;
-                }
-                else if(lex == "divu") {
-                    printArgsBinary(0, fakeTokenLine[i+1].toNumber(), fakeTokenLine[i+3].toNumber(), 
-                    0, 27);
-                    i += 3;
-                }
-
-                else if(lex == "lw") {
-                    printBranchBinary(35, fakeTokenLine[i+5].toNumber(), fakeTokenLine[i+1].toNumber(), 
-                        fakeTokenLine[i+3].toNumber());
+                else if(lex == "lw" || lex == "sw") {
+                    printBinary(encodeInstruction(lex, {fakeTokenLine[i+1].toNumber(),
+                        fakeTokenLine[i+3].toNumber(), fakeTokenLine[i+5].toNumber()}));
                     i += 6;
                 }
-                else if(lex == "sw") {
-                    printBranchBinary(43, fakeTokenLine[i+5].toNumber(), fakeTokenLine[i+1].toNumber(), 
-                        fakeTokenLine[i+3].toNumber());
-                    i += 6;
+                else if(isMnemonic(lex)) {
+                    // registers are every other token: "add $3, $2, $4"
+                    vector<int64_t> operands;
+                    int j = i + 1;
+                    for(; j < lineSize && fakeTokenLine[j].getKind() == 8; j += 2) {
+                        operands.push_back(fakeTokenLine[j].toNumber());
+                    }
+                    printBinary(encodeInstruction(lex, operands));
+                    i = j - 1;
                 }
 
                 else if((what == 0 && what != 10) || what == 7){
@@ -418,7 +286,8 @@ int main() {
                 }
 
             } 
-            ++numline;
+            // a line holding only a label takes no space, as in the first pass
+            if(fakeTokenLine.size() != 1 || fakeTokenLine[0].getKind() != 1) ++numline;
         }
         printLabels(address, labels);
     } 
@@ -1,16 +1,10 @@
 #include "asm.h"
+#include "encoder.h"
 #include <vector>
 using namespace std;
 
 void printBinary(int64_t n) {
-    unsigned char c = n >> 24;
-    cout << c;
-    c = n >> 16;
-    cout << c;
-    c = n >> 8;
-    cout << c;
-    c = n;
-    cout << c;
+    printWord(cout, n);
 }
 
 unsigned char getBinary(int64_t n) {
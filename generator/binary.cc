@@ -0,0 +1,114 @@
+#include "binary.h"
+#include "encoder.h"
+#include <set>
+
+/**
+* Converts an operand to a number: "$n" is register n, anything else is a decimal or hex integer.
+*
+* @param operand - The operand as written in assembly
+* @param value - Where the number is stored
+*
+* @return false if the operand is not a register or a number
+*/
+static bool toNumber(string operand, int64_t &value) {
+    if(operand.empty()) return false;
+    if(operand[0] == '$') operand = operand.substr(1);
+    if(!isdigit(operand[0]) && operand[0] != '-') return false;
+    try {
+        value = stoll(operand, nullptr, 0);
+    }
+    catch(...) {
+        return false;
+    }
+    return true;
+}
+
+/**
+* Assembles a program and writes it as a MERL object file.
+*
+* @param program - The program to assemble
+* @param out - The stream the object file is written to
+*
+* @return false if the program references an undefined label or contains an unknown instruction
+*/
+bool writeObject(const vector<Instruction> &program, ostream &out) {
+    const int64_t header = 12;
+    map<string, int64_t> labels;
+    set<string> imports;
+    vector<string> exports;
+    int64_t address = header;
+    for(auto &instr: program) {
+        if(instr.isLabel()) labels[instr.label] = address;
+        if(instr.op == ".import") imports.insert(instr.args[0]);
+        if(instr.op == ".export") exports.push_back(instr.args[0]);
+        if(instr.isCode()) address += 4;
+    }
+
+    vector<int64_t> code;
+    vector<int64_t> relocations;
+    vector<pair<int64_t, string>> references;
+    address = header;
+    for(auto &instr: program) {
+        if(!instr.isCode()) continue;
+        int64_t word = 0;
+        if(instr.op == ".word") {
+            string operand = instr.args[0];
+            if(toNumber(operand, word)) {}
+            else if(labels.count(operand)) {
+                word = labels[operand];
+                relocations.push_back(address);
+            }
+            else if(imports.count(operand)) references.push_back({address, operand});
+            else {
+                cerr << "ERROR: undefined label \"" << operand << "\"" << endl;
+                return false;
+            }
+        }
+        else if(isMnemonic(instr.op)) {
+            vector<int64_t> operands;
+            for(int i = 0; i < instr.args.size(); i++) {
+                int64_t value;
+                if(toNumber(instr.args[i], value)) operands.push_back(value);
+                else if(labels.count(instr.args[i]) && i == 2) operands.push_back((labels[instr.args[i]] - address - 4) / 4);
+                else {
+                    cerr << "ERROR: invalid operand \"" << instr.args[i] << "\" for " << instr.op << endl;
+                    return false;
+                }
+            }
+            word = encodeInstruction(instr.op, operands);
+        }
+        else {
+            cerr << "ERROR: unknown instruction \"" << instr.op << "\"" << endl;
+            return false;
+        }
+        code.push_back(word);
+        address += 4;
+    }
+
+    vector<int64_t> table;
+    for(auto location: relocations) {
+        table.push_back(0x01);
+        table.push_back(location);
+    }
+    for(auto &reference: references) {
+        table.push_back(0x11);
+        table.push_back(reference.first);
+        table.push_back(reference.second.size());
+        for(char c: reference.second) table.push_back(c);
+    }
+    for(auto &name: exports) {
+        if(!labels.count(name)) continue;
+        table.push_back(0x05);
+        table.push_back(labels[name]);
+        table.push_back(name.size());
+        for(char c: name) table.push_back(c);
+    }
+
+    int64_t endCode = header + 4 * code.size();
+    printWord(out, 0x10000002);
+    printWord(out, endCode + 4 * table.size());
+    printWord(out, endCode);
+    for(auto word: code) printWord(out, word);
+    for(auto word: table) printWord(out, word);
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include "instruction.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+/*
+ * Assembles the generated program in memory and writes it as a MERL object file, the format
+ * cs241.linker expects: a header, the code starting at address 12, then a table with a REL
+ * entry for every .word holding a label address and an ESR entry for every use of an imported
+ * symbol (print, init, new, delete).
+ */
+bool writeObject(const vector<Instruction>&, ostream&);
+
+#endif
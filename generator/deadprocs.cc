@@ -0,0 +1,59 @@
+#include "irpasses.h"
+#include "passes.h"
+
+/**
+* Collects the procedures a function calls.
+*
+* @param function - The caller
+*
+* @return The names of its callees
+*/
+static set<string> callees(Function &function) {
+    set<string> names;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CALL) names.insert(inst.callee);
+        }
+    }
+    return names;
+}
+
+/**
+* Removes the procedures that cannot be reached from wain through the call graph, so that no code
+* is emitted for them. They have already been type checked when the module was built. Every
+* procedure removed is reported as a remark with its size, and the totals as statistics.
+*
+* @param module - The module to optimize
+*
+* @return true if any procedure was removed
+*/
+bool removeDeadProcedures(Module &module) {
+    if(!module.getFunction("wain")) return false;
+    set<string> reached = {"wain"};
+    vector<string> work = {"wain"};
+    while(!work.empty()) {
+        Function *function = module.getFunction(work.back());
+        work.pop_back();
+        if(!function) continue;
+        for(auto &callee: callees(*function)) {
+            if(reached.insert(callee).second) work.push_back(callee);
+        }
+    }
+    vector<unique_ptr<Function>> kept;
+    int removed = 0, size = 0;
+    for(auto &function: module.functions) {
+        if(reached.count(function->name)) {
+            kept.push_back(move(function));
+            continue;
+        }
+        int insts = function->countInsts();
+        PassManager::remark("dead-procedures", "removed " + function->name + " (" + to_string(insts) + " IR instructions)");
+        removed++;
+        size += insts;
+    }
+    module.functions = move(kept);
+    if(!removed) return false;
+    PassManager::recordStatistic("dead-procedures", "procedures removed", removed);
+    PassManager::recordStatistic("dead-procedures", "IR instructions removed", size);
+    return true;
+}
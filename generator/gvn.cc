@@ -0,0 +1,176 @@
+#include "irpasses.h"
+#include "passes.h"
+#include <algorithm>
+#include <tuple>
+
+// what an instruction computes: its opcode, signedness, constant and the numbers of its operands
+typedef tuple<Opcode, bool, int, vector<int>> Expression;
+
+// a value used twice is kept in a frame slot (a sw, and a lw when the register was reused), so
+// only computations that take at least this many instructions to repeat are removed
+static const int MIN_WEIGHT = 2;
+
+/**
+* Returns the number of instructions an instruction costs on its own. Constants, loads of slots
+* (often just a register) and slot addresses count nothing, as they are folded into or next to
+* the instruction that reads them.
+*
+* @param inst - The instruction
+*
+* @return The cost
+*/
+static int instructionCost(const Inst &inst) {
+    switch(inst.op) {
+        case OP_CONST: case OP_SLOAD: case OP_ADDR:
+            return 0;
+        case OP_MUL: case OP_DIV: case OP_REM: case OP_MULHI:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+/**
+* Checks if the operands of an instruction can be swapped without changing its value.
+*
+* @param op - The opcode
+*
+* @return true for addition, multiplication and (in)equality
+*/
+static bool isCommutative(Opcode op) {
+    return op == OP_ADD || op == OP_MUL || op == OP_MULHI || op == OP_EQ || op == OP_NE;
+}
+
+/**
+* Finds instructions that compute a value already computed by an instruction that dominates
+* them, and uses that value instead. The dominator tree is walked from the entry; each block
+* sees the expressions available at the end of its immediate dominator. Loads of slots and of
+* memory are only carried from a block into a successor that has no other predecessor, and are
+* forgotten when something may change what they read:
+*   - a store to a slot, for the loads of that slot;
+*   - a store through a pointer or a call, for the loads of memory and of slots whose address
+*     is taken;
+*   - a delete, for the loads of memory.
+*/
+class ValueNumbering {
+	public:
+		ValueNumbering(Function &function) : function{function} {}
+		bool run();
+	private:
+		Function &function;
+		map<Block*, vector<Block*>> children;
+		set<int> addressTaken;
+		// value -> the value with the same number that was computed first
+		map<int, int> leader;
+		// removed value -> the value its uses read instead
+		map<int, int> replacement;
+		// value -> number of instructions it takes to compute it from slots and constants
+		map<int, int> weight;
+
+		void visit(Block*, map<Expression, int>, map<Expression, int>);
+		void invalidate(Inst&, map<Expression, int>&);
+};
+
+/**
+* Forgets the loads an instruction may change the result of.
+*
+* @param inst - The instruction
+* @param memory - The available loads
+*/
+void ValueNumbering::invalidate(Inst &inst, map<Expression, int> &memory) {
+    if(inst.op != OP_SSTORE && inst.op != OP_STORE && inst.op != OP_CALL && inst.op != OP_DELETE) return;
+    for(auto it = memory.begin(); it != memory.end();) {
+        Opcode op = get<0>(it->first);
+        int slot = get<2>(it->first);
+        bool clobbered;
+        if(inst.op == OP_SSTORE) clobbered = op == OP_SLOAD ? slot == inst.imm : addressTaken.count(inst.imm);
+        else if(inst.op == OP_DELETE) clobbered = op == OP_LOAD;
+        else clobbered = op == OP_LOAD || addressTaken.count(slot);
+        if(clobbered) it = memory.erase(it);
+        else ++it;
+    }
+}
+
+/**
+* Numbers the instructions of a block and removes the ones whose value is already available,
+* then visits the blocks it immediately dominates.
+*
+* @param block - The block
+* @param pure - The available expressions that do not read memory
+* @param memory - The available loads
+*/
+void ValueNumbering::visit(Block *block, map<Expression, int> pure, map<Expression, int> memory) {
+    vector<Inst> kept;
+    for(auto &inst: block->insts) {
+        for(auto &arg: inst.args) {
+            if(replacement.count(arg)) arg = replacement[arg];
+        }
+        invalidate(inst, memory);
+        if(inst.dst < 0 || inst.hasSideEffects() || inst.op == OP_PHI || inst.op == OP_PARAM) {
+            kept.push_back(inst);
+            continue;
+        }
+        vector<int> numbers;
+        weight[inst.dst] = instructionCost(inst);
+        for(auto arg: inst.args) {
+            numbers.push_back(leader.count(arg) ? leader[arg] : arg);
+            weight[inst.dst] += weight[arg];
+        }
+        if(isCommutative(inst.op)) sort(numbers.begin(), numbers.end());
+        Expression expression(inst.op, inst.isUnsigned, inst.imm, numbers);
+        map<Expression, int> &available = inst.op == OP_SLOAD || inst.op == OP_LOAD ? memory : pure;
+        if(!available.count(expression)) {
+            available[expression] = inst.dst;
+            kept.push_back(inst);
+            continue;
+        }
+        leader[inst.dst] = available[expression];
+        if(weight[inst.dst] < MIN_WEIGHT) kept.push_back(inst);
+        else replacement[inst.dst] = available[expression];
+    }
+    block->insts = kept;
+    for(auto child: children[block]) {
+        bool extends = child->preds.size() == 1 && child->preds[0] == block;
+        visit(child, pure, extends ? memory : map<Expression, int>());
+    }
+}
+
+/**
+* Numbers the whole function, then makes the uses of removed instructions read the values that
+* replaced them; the phis are done last, as their operands may come from blocks visited later.
+*
+* @return true if the function was changed
+*/
+bool ValueNumbering::run() {
+    map<Block*, Block*> idom = computeDominators(function);
+    for(auto &block: function.blocks) {
+        Block *dom = idom.count(block.get()) ? idom[block.get()] : block.get();
+        if(dom != block.get()) children[dom].push_back(block.get());
+    }
+    addressTaken = findAddressTakenSlots(function);
+    visit(function.entry(), {}, {});
+    if(replacement.empty()) return false;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op != OP_PHI) continue;
+            for(auto &arg: inst.args) {
+                if(replacement.count(arg)) arg = replacement[arg];
+            }
+        }
+    }
+    removeDeadValues(function);
+    PassManager::recordStatistic("gvn", "instructions removed", replacement.size());
+    return true;
+}
+
+/**
+* Removes computations whose value is already available from a dominating instruction.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool eliminateCommonSubexpressions(Function &function) {
+    ValueNumbering numbering(function);
+    return numbering.run();
+}
@@ -0,0 +1,213 @@
+#include "irpasses.h"
+#include "passes.h"
+
+// rough costs in executed instructions: a conditional branch and the jump over the other arm,
+// and a multiplication (mult, mflo and the wait for the result)
+static const int BRANCH_COST = 2;
+static const int MULTIPLY_COST = 4;
+
+// one arm of an IF: the code computing the value it assigns, and that value
+struct Arm {
+    vector<Inst> code;
+    int value = -1;
+    int cost = 0;
+};
+
+/**
+* Checks if an instruction can be run even when its arm would not have been: it has no side
+* effects and cannot trap, so loads through pointers and divisions by anything but a non-zero
+* constant are excluded.
+*
+* @param inst - The instruction
+* @param constants - The value of every constant in the function
+*
+* @return true if the instruction may be moved in front of the branch
+*/
+static bool isSpeculatable(const Inst &inst, map<int, int> &constants) {
+    if(inst.dst < 0 || inst.hasSideEffects() || inst.op == OP_PHI || inst.op == OP_LOAD) return false;
+    if(inst.op != OP_DIV && inst.op != OP_REM) return true;
+    return constants.count(inst.args[1]) && constants[inst.args[1]] != 0;
+}
+
+/**
+* Returns the cost of computing a product with a value that is 0 or 1, after strength reduction.
+*
+* @param factor - The other factor, if it is a constant
+* @param known - true if the other factor is a constant
+*
+* @return The cost
+*/
+static int multiplyCost(int factor, bool known) {
+    int k = known ? exactLog2(factor) : -1;
+    return k >= 0 && k <= 4 ? k : MULTIPLY_COST;
+}
+
+/**
+* Replaces IF statements whose arms only assign a side-effect-free expression to the same
+* variable by a branch-free select. With the condition c being 0 or 1, the variable is assigned
+* b + c * (a - b), or just c or 1 - c when the values are the constants 1 and 0. There is no AND
+* on this machine, so the select needs a multiplication; the conversion is only done when the
+* cost model finds both arms and the select cheaper than the branches they replace.
+*/
+class IfConversion {
+	public:
+		IfConversion(Function &function) : function{function} {}
+		bool run();
+	private:
+		Function &function;
+		map<int, int> constants;
+		map<int, Inst*> definitions;
+
+		bool readArm(Block*, Block*, int&, Arm&);
+		bool convert(Block*);
+		int emit(vector<Inst>&, Opcode, vector<int>, int = 0);
+};
+
+/**
+* Collects the code of one arm. An arm is a block with no other predecessor that computes a value
+* without side effects, stores it to a slot and branches to the join block; a branch straight to
+* the join block is an empty arm that leaves the slot as it was.
+*
+* @param target - The block the branch goes to for this arm
+* @param join - The block where both arms meet
+* @param slot - The slot assigned, or -1 if not known yet; set from the arm's store
+* @param arm - Set to the arm
+*
+* @return true if the arm has the right shape
+*/
+bool IfConversion::readArm(Block *target, Block *join, int &slot, Arm &arm) {
+    if(target == join) return true;
+    if(target->preds.size() != 1 || target->terminator().op != OP_BR || target->terminator().blocks[0] != join) return false;
+    for(auto &inst: target->insts) {
+        if(inst.isTerminator()) break;
+        if(inst.op == OP_SSTORE && arm.value < 0 && (slot < 0 || slot == inst.imm)) {
+            slot = inst.imm;
+            arm.value = inst.args[0];
+            continue;
+        }
+        if(arm.value >= 0 || !isSpeculatable(inst, constants)) return false;
+        arm.code.push_back(inst);
+        arm.cost += inst.op == OP_MUL || inst.op == OP_MULHI ? MULTIPLY_COST : 1;
+    }
+    return arm.value >= 0;
+}
+
+/**
+* Appends an instruction defining a new int.
+*
+* @param insts - Where to append it
+* @param op - The opcode
+* @param args - The operands
+* @param imm - The constant, for OP_CONST
+*
+* @return The value it defines
+*/
+int IfConversion::emit(vector<Inst> &insts, Opcode op, vector<int> args, int imm) {
+    Inst inst(op);
+    inst.dst = function.newValue(INT);
+    inst.args = args;
+    inst.imm = imm;
+    insts.push_back(inst);
+    return inst.dst;
+}
+
+/**
+* Converts the IF that ends a block, if it has the right shape and the cost model agrees.
+*
+* @param head - The block ending in the conditional branch
+*
+* @return true if the IF was converted
+*/
+bool IfConversion::convert(Block *head) {
+    Inst &branch = head->terminator();
+    if(branch.op != OP_CONDBR || branch.blocks[0] == branch.blocks[1]) return false;
+    Inst *condition = definitions[branch.args[0]];
+    if(!condition || !condition->isCompare()) return false;
+    Block *thenBlock = branch.blocks[0], *elseBlock = branch.blocks[1];
+    // the join block is where an arm branches to, or the other target if that arm is empty
+    auto jumpsTo = [](Block *block) { return block->terminator().op == OP_BR ? block->terminator().blocks[0] : nullptr; };
+    Block *join = nullptr;
+    if(jumpsTo(thenBlock) && (jumpsTo(thenBlock) == elseBlock || jumpsTo(thenBlock) == jumpsTo(elseBlock))) join = jumpsTo(thenBlock);
+    else if(jumpsTo(elseBlock) == thenBlock) join = thenBlock;
+    if(!join || join == head) return false;
+    for(auto &inst: join->insts) {
+        if(inst.op == OP_PHI) return false;
+    }
+    int slot = -1;
+    Arm yes, no;
+    if(!readArm(thenBlock, join, slot, yes) || !readArm(elseBlock, join, slot, no) || slot < 0) return false;
+    if(function.slots[slot].type != INT) return false;
+
+    vector<Inst> code = yes.code;
+    code.insert(code.end(), no.code.begin(), no.code.end());
+    int cost = yes.cost + no.cost + 1;
+    // an empty arm keeps the value the slot had
+    for(auto arm: {&yes, &no}) {
+        if(arm->value >= 0) continue;
+        arm->value = emit(code, OP_SLOAD, {});
+        code.back().imm = slot;
+        cost++;
+    }
+    int a = yes.value, b = no.value, c = branch.args[0], result;
+    bool constantA = constants.count(a), constantB = constants.count(b);
+    if(constantA && constantB && constants[a] == 1 && constants[b] == 0) result = c;
+    else if(constantA && constantB && constants[a] == 0 && constants[b] == 1) {
+        result = emit(code, OP_SUB, {emit(code, OP_CONST, {}, 1), c});
+        cost += 2;
+    }
+    else {
+        int difference;
+        if(constantA && constantB) difference = emit(code, OP_CONST, {}, constants[a] - constants[b]);
+        else difference = emit(code, OP_SUB, {a, b});
+        cost += 2 + multiplyCost(constantA && constantB ? constants[a] - constants[b] : 0, constantA && constantB);
+        result = emit(code, OP_ADD, {b, emit(code, OP_MUL, {c, difference})});
+    }
+    int branchy = BRANCH_COST + max(yes.cost, no.cost) + 1;
+    if(cost > branchy) return false;
+
+    Inst store(OP_SSTORE);
+    store.args = {result};
+    store.imm = slot;
+    code.push_back(store);
+    head->insts.pop_back();
+    head->insts.insert(head->insts.end(), code.begin(), code.end());
+    Inst jump(OP_BR);
+    jump.blocks = {join};
+    head->insts.push_back(jump);
+    return true;
+}
+
+/**
+* Converts every IF with the right shape, then removes the arms left unreachable.
+*
+* @return true if the function was changed
+*/
+bool IfConversion::run() {
+    function.computePreds();
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CONST) constants[inst.dst] = inst.imm;
+            if(inst.dst >= 0) definitions[inst.dst] = &inst;
+        }
+    }
+    int converted = 0;
+    for(int b = 0; b < function.blocks.size(); b++) {
+        if(convert(function.blocks[b].get())) converted++;
+    }
+    if(!converted) return false;
+    removeUnreachableBlocks(function);
+    PassManager::recordStatistic("if-convert", "ifs converted", converted);
+    return true;
+}
+
+/**
+* Turns IF statements that assign one of two simple values to a variable into branch-free code.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool convertIfs(Function &function) {
+    IfConversion conversion(function);
+    return conversion.run();
+}
@@ -0,0 +1,273 @@
+#include "irpasses.h"
+#include "passes.h"
+#include <algorithm>
+
+// callees of at most this many IR instructions are inlined at every call site
+static const int INLINE_THRESHOLD = 24;
+// a procedure called from a single place is inlined up to this size, as its own body then goes away
+static const int SINGLE_CALL_THRESHOLD = 160;
+// no procedure grows past this many IR instructions through inlining
+static const int CALLER_LIMIT = 1000;
+
+/**
+* Substitutes the bodies of procedures at their call sites. The call graph is split into strongly
+* connected components (Tarjan), which come out callees first, so a procedure is only inlined
+* after the calls inside it were. Procedures in a recursive component are never inlined; the
+* others are if they are small or only called once, as long as the caller stays within a limit.
+*/
+class Inliner {
+	public:
+		Inliner(Module &module) : module{module} {}
+		bool run();
+	private:
+		Module &module;
+		// caller -> callees, and the number of call sites of every procedure
+		map<string, set<string>> calls;
+		map<string, int> callSites;
+		set<string> recursive, inlined;
+		vector<vector<string>> components;
+		// state of Tarjan's algorithm
+		map<string, int> index, lowlink;
+		vector<string> stack;
+		set<string> onStack;
+
+		void buildCallGraph();
+		void strongConnect(string);
+		bool shouldInline(Function&, Function&);
+		bool inlineCalls(Function&);
+		int inlineCall(Function&, int, int, Function&);
+};
+
+/**
+* Records the callees of every procedure and how many times each one is called.
+*/
+void Inliner::buildCallGraph() {
+    for(auto &function: module.functions) {
+        calls[function->name];
+        for(auto &block: function->blocks) {
+            for(auto &inst: block->insts) {
+                if(inst.op != OP_CALL) continue;
+                calls[function->name].insert(inst.callee);
+                callSites[inst.callee]++;
+            }
+        }
+    }
+}
+
+/**
+* Visits a procedure in Tarjan's algorithm, emitting its strongly connected component once all
+* the procedures it can reach have been visited.
+*
+* @param name - The procedure to visit
+*/
+void Inliner::strongConnect(string name) {
+    int number = index.size();
+    index[name] = lowlink[name] = number;
+    stack.push_back(name);
+    onStack.insert(name);
+    for(auto &callee: calls[name]) {
+        if(!calls.count(callee)) continue;
+        if(!index.count(callee)) {
+            strongConnect(callee);
+            lowlink[name] = min(lowlink[name], lowlink[callee]);
+        }
+        else if(onStack.count(callee)) lowlink[name] = min(lowlink[name], index[callee]);
+    }
+    if(lowlink[name] != index[name]) return;
+    vector<string> component;
+    do {
+        component.push_back(stack.back());
+        onStack.erase(stack.back());
+        stack.pop_back();
+    } while(component.back() != name);
+    if(component.size() > 1 || calls[name].count(name)) recursive.insert(component.begin(), component.end());
+    components.push_back(component);
+}
+
+/**
+* Applies the cost model to one call site and reports the decision as a remark.
+*
+* @param caller - The procedure making the call
+* @param callee - The procedure being called
+*
+* @return true if the call should be inlined
+*/
+bool Inliner::shouldInline(Function &caller, Function &callee) {
+    string call = callee.name + " into " + caller.name;
+    int size = callee.countInsts();
+    if(recursive.count(callee.name)) {
+        PassManager::remark("inline", "not inlining " + call + ": recursive");
+        return false;
+    }
+    bool once = callSites[callee.name] == 1 && callee.name != "wain";
+    if(size > INLINE_THRESHOLD && !(once && size <= SINGLE_CALL_THRESHOLD)) {
+        PassManager::remark("inline", "not inlining " + call + ": too large (" + to_string(size) + " IR instructions)");
+        return false;
+    }
+    if(caller.countInsts() + size > CALLER_LIMIT) {
+        PassManager::remark("inline", "not inlining " + call + ": " + caller.name + " would grow past " + to_string(CALLER_LIMIT) + " IR instructions");
+        return false;
+    }
+    PassManager::remark("inline", "inlined " + call + " (" + to_string(size) + " IR instructions)");
+    return true;
+}
+
+/**
+* Replaces one call by a copy of the callee's body. The block holding the call is split in two;
+* the first half stores the arguments to fresh copies of the parameter slots and branches to the
+* copied entry block, and every return branches to the second half, where a phi merges the
+* returned values if there is more than one.
+*
+* @param caller - The procedure making the call
+* @param b - The position of the block holding the call
+* @param i - The position of the call in the block
+* @param callee - The procedure being called
+*
+* @return The position of the block holding the code after the call
+*/
+int Inliner::inlineCall(Function &caller, int b, int i, Function &callee) {
+    Block *block = caller.blocks[b].get();
+    Inst call = block->insts[i];
+    vector<Inst> after(block->insts.begin() + i + 1, block->insts.end());
+    block->insts.erase(block->insts.begin() + i, block->insts.end());
+    int firstBlock = caller.blocks.size();
+    int firstSlot = caller.slots.size();
+    for(auto &slot: callee.slots) caller.slots.push_back({callee.name + "." + slot.name, slot.type, -1});
+    vector<int> values;
+    for(auto type: callee.valueTypes) values.push_back(caller.newValue(type));
+    map<Block*, Block*> blocks;
+    for(auto &original: callee.blocks) {
+        blocks[original.get()] = caller.newBlock(original->name);
+        for(auto &inst: original->insts) {
+            if(inst.op == OP_PARAM) values[inst.dst] = call.args[inst.imm];
+        }
+    }
+    Block *rest = caller.newBlock(block->name);
+    rest->insts = after;
+    // the successors of the call's block now have the second half as their predecessor
+    for(auto succ: rest->succs()) {
+        for(auto &inst: succ->insts) {
+            if(inst.op != OP_PHI) continue;
+            for(auto &incoming: inst.blocks) {
+                if(incoming == block) incoming = rest;
+            }
+        }
+    }
+
+    for(int k = 0; k < callee.slots.size(); k++) {
+        if(callee.slots[k].param < 0) continue;
+        Inst store(OP_SSTORE);
+        store.args = {call.args[callee.slots[k].param]};
+        store.imm = firstSlot + k;
+        block->insts.push_back(store);
+    }
+    Inst enter(OP_BR);
+    enter.blocks = {blocks[callee.entry()]};
+    block->insts.push_back(enter);
+
+    Inst merge(OP_PHI);
+    merge.dst = call.dst;
+    for(auto &original: callee.blocks) {
+        Block *copy = blocks[original.get()];
+        for(auto inst: original->insts) {
+            if(inst.op == OP_PARAM) continue;
+            if(inst.dst >= 0) inst.dst = values[inst.dst];
+            for(auto &arg: inst.args) arg = values[arg];
+            for(auto &target: inst.blocks) target = blocks[target];
+            if(inst.op == OP_SLOAD || inst.op == OP_SSTORE || inst.op == OP_ADDR) inst.imm += firstSlot;
+            if(inst.op == OP_RET) {
+                merge.args.push_back(inst.args[0]);
+                merge.blocks.push_back(copy);
+                inst = Inst(OP_BR);
+                inst.blocks = {rest};
+            }
+            copy->insts.push_back(inst);
+        }
+    }
+    if(merge.args.size() == 1) replaceAllUses(caller, call.dst, merge.args[0]);
+    else rest->insts.insert(rest->insts.begin(), merge);
+
+    // lay the copied body out between the two halves
+    rotate(caller.blocks.begin() + b + 1, caller.blocks.begin() + firstBlock, caller.blocks.end());
+    callSites[callee.name]--;
+    inlined.insert(callee.name);
+    for(auto &name: calls[callee.name]) {
+        for(auto &original: callee.blocks) {
+            for(auto &inst: original->insts) {
+                if(inst.op == OP_CALL && inst.callee == name) callSites[name]++;
+            }
+        }
+        calls[caller.name].insert(name);
+    }
+    return b + callee.blocks.size() + 1;
+}
+
+/**
+* Inlines the calls in one procedure that pass the cost model. The copied bodies are not
+* searched again, as the calls left in them were already turned down for the callee.
+*
+* @param function - The procedure whose calls are considered
+*
+* @return true if any call was inlined
+*/
+bool Inliner::inlineCalls(Function &function) {
+    bool changed = false;
+    int b = 0, i = 0;
+    while(b < function.blocks.size()) {
+        Block *block = function.blocks[b].get();
+        if(i >= block->insts.size()) {
+            b++;
+            i = 0;
+            continue;
+        }
+        Inst &inst = block->insts[i];
+        Function *callee = inst.op == OP_CALL ? module.getFunction(inst.callee) : nullptr;
+        if(!callee || callee == &function || !shouldInline(function, *callee)) {
+            i++;
+            continue;
+        }
+        b = inlineCall(function, b, i, *callee);
+        i = 0;
+        PassManager::recordStatistic("inline", "calls inlined", 1);
+        changed = true;
+    }
+    if(changed) function.computePreds();
+    return changed;
+}
+
+/**
+* Runs the inliner over the components of the call graph, callees first, and deletes the
+* procedures whose every call was inlined.
+*
+* @return true if the module was changed
+*/
+bool Inliner::run() {
+    buildCallGraph();
+    for(auto &function: module.functions) {
+        if(!index.count(function->name)) strongConnect(function->name);
+    }
+    bool changed = false;
+    for(auto &component: components) {
+        for(auto &name: component) changed |= inlineCalls(*module.getFunction(name));
+    }
+    if(!changed) return false;
+    vector<unique_ptr<Function>> kept;
+    for(auto &function: module.functions) {
+        if(!inlined.count(function->name) || callSites[function->name] > 0) kept.push_back(move(function));
+        else PassManager::remark("inline", "removed " + function->name + ", every call to it was inlined");
+    }
+    module.functions = move(kept);
+    return true;
+}
+
+/**
+* Substitutes small non-recursive procedures at their call sites.
+*
+* @param module - The module to optimize
+*
+* @return true if any call was inlined
+*/
+bool inlineProcedures(Module &module) {
+    Inliner inliner(module);
+    return inliner.run();
+}
@@ -0,0 +1,136 @@
+#include "instruction.h"
+#include <sstream>
+
+Instruction::Instruction() {}
+
+/**
+* Creates an instruction from a mnemonic and its operands. The text is left empty so the
+* instruction is printed in the canonical form.
+*
+* @param op - The mnemonic or directive, e.g. "add" or ".word"
+* @param args - The operands as they are written in assembly
+*/
+Instruction::Instruction(string op, vector<string> args) : op{op}, args{args} {}
+
+/**
+* Parses a line of generated assembly. The original text is kept so that unchanged lines are
+* printed exactly as the generator wrote them.
+*
+* @param line - The line to parse
+*
+* @return The parsed instruction
+*/
+Instruction Instruction::parse(string line) {
+    Instruction instr;
+    instr.text = line;
+    string code = line.substr(0, line.find(';'));
+    for(auto &c: code) {
+        if(c == ',' || c == '(' || c == ')' || c == '\t') c = ' ';
+    }
+    stringstream stream{code};
+    string token;
+    if(!(stream >> token)) return instr;
+    if(token.back() == ':') {
+        token.pop_back();
+        instr.label = token;
+        return instr;
+    }
+    instr.op = token;
+    while(stream >> token) instr.args.push_back(token);
+    return instr;
+}
+
+/**
+* Creates a label line.
+*
+* @param name - The name of the label without the colon
+*
+* @return The label instruction
+*/
+Instruction Instruction::makeLabel(string name) {
+    Instruction instr;
+    instr.label = name;
+    return instr;
+}
+
+/**
+* Checks if this line defines a label.
+*
+* @return true if the line is a label
+*/
+bool Instruction::isLabel() const { return label != ""; }
+
+/**
+* Checks if this line occupies a word in the assembled program, i.e. it is an instruction or a
+* .word directive.
+*
+* @return true if the line produces machine code
+*/
+bool Instruction::isCode() const {
+    return op != "" && op != ".import" && op != ".export";
+}
+
+/**
+* Checks if this line is a conditional or unconditional branch to a label.
+*
+* @return true if the line is a beq or bne whose target is a label
+*/
+bool Instruction::isBranch() const {
+    if(op != "beq" && op != "bne") return false;
+    if(args.size() != 3) return false;
+    char c = args[2][0];
+    return !(c == '-' || (c >= '0' && c <= '9'));
+}
+
+/**
+* Checks if control never falls through this line, i.e. it is a "beq $0, $0, label" or a jr.
+*
+* @return true if the next line is only reachable through a label
+*/
+bool Instruction::isUnconditionalJump() const {
+    if(op == "jr") return true;
+    return op == "beq" && args.size() == 3 && args[0] == "$0" && args[1] == "$0";
+}
+
+/**
+* Returns the label a branch jumps to.
+*
+* @return The target label or the empty string if this is not a branch to a label
+*/
+string Instruction::branchTarget() const {
+    if(!isBranch()) return "";
+    return args[2];
+}
+
+/**
+* Formats the line as assembly. Lines that came from the generator are printed as written.
+*
+* @return The assembly text for the line
+*/
+string Instruction::toString() const {
+    if(text != "") return text;
+    if(isLabel()) return label + ":";
+    string result = op;
+    if(op == "lw" || op == "sw") {
+        return result + " " + args[0] + ", " + args[1] + "(" + args[2] + ")";
+    }
+    for(int i = 0; i < args.size(); i++) {
+        result += (i == 0 ? " " : ", ") + args[i];
+    }
+    return result;
+}
+
+/**
+* Counts the lines of a program that produce machine code.
+*
+* @param program - The program to count
+*
+* @return The number of instructions and .word directives in the program
+*/
+int countInstructions(const vector<Instruction> &program) {
+    int count = 0;
+    for(auto &instr: program) {
+        if(instr.isCode()) count++;
+    }
+    return count;
+}
@@ -0,0 +1,40 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+/*
+ * One line of generated MIPS assembly. A line is either a label ("name:"),
+ * an instruction or directive ("add $3, $5, $3", ".word 4", ".import print"),
+ * or a line that only carries a comment or whitespace.
+ *
+ * Operands are kept as they are written in the assembly, so registers keep
+ * their "$". For lw and sw the operands are stored as {rt, offset, base}.
+ */
+class Instruction {
+	public:
+		string label;
+		string op;
+		vector<string> args;
+		string text;
+
+		Instruction();
+		Instruction(string, vector<string>);
+
+		static Instruction parse(string);
+		static Instruction makeLabel(string);
+
+		bool isLabel() const;
+		bool isCode() const;
+		bool isBranch() const;
+		bool isUnconditionalJump() const;
+		string branchTarget() const;
+		string toString() const;
+};
+
+int countInstructions(const vector<Instruction>&);
+
+#endif
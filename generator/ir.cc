@@ -0,0 +1,602 @@
+#include "ir.h"
+#include <functional>
+
+/**
+* Checks if the instruction ends a basic block.
+*
+* @return true for BR, CONDBR and RET
+*/
+bool Inst::isTerminator() const {
+    return op == OP_BR || op == OP_CONDBR || op == OP_RET;
+}
+
+/**
+* Checks if the instruction does anything besides defining its value, i.e. it writes memory,
+* performs I/O, allocates or transfers control. Such instructions can never be deleted or
+* reordered with each other.
+*
+* @return true if the instruction has side effects
+*/
+bool Inst::hasSideEffects() const {
+    switch(op) {
+        case OP_STORE: case OP_SSTORE: case OP_CALL: case OP_PRINT: case OP_NEW: case OP_DELETE:
+            return true;
+        default:
+            return isTerminator();
+    }
+}
+
+/**
+* Checks if the instruction is a comparison producing 0 or 1.
+*
+* @return true for LT, LE, GT, GE, EQ and NE
+*/
+bool Inst::isCompare() const {
+    return op == OP_LT || op == OP_LE || op == OP_GT || op == OP_GE || op == OP_EQ || op == OP_NE;
+}
+
+/**
+* Returns the last instruction of the block, which is always its terminator once the block has
+* been built.
+*
+* @return The terminator of the block
+*/
+Inst &Block::terminator() { return insts.back(); }
+
+/**
+* Returns the blocks control can flow to from this block.
+*
+* @return The successors of the block, in branch order
+*/
+vector<Block*> Block::succs() {
+    if(insts.empty() || !insts.back().isTerminator()) return {};
+    return insts.back().blocks;
+}
+
+/**
+* Appends a new empty block to the function.
+*
+* @param name - A name for the block, used for labels and the IR dump
+*
+* @return The new block
+*/
+Block *Function::newBlock(string name) {
+    auto block = make_unique<Block>();
+    block->id = blockCount++;
+    block->name = name;
+    blocks.push_back(move(block));
+    return blocks.back().get();
+}
+
+/**
+* Creates a new virtual register.
+*
+* @param type - The WLP4 type of the value
+*
+* @return The number of the new value
+*/
+int Function::newValue(Type type) {
+    valueTypes.push_back(type);
+    return valueTypes.size() - 1;
+}
+
+/**
+* Returns the block where execution of the function starts.
+*
+* @return The entry block
+*/
+Block *Function::entry() { return blocks[0].get(); }
+
+/**
+* Recomputes the predecessor list of every block from the terminators.
+*/
+void Function::computePreds() {
+    for(auto &block: blocks) block->preds.clear();
+    for(auto &block: blocks) {
+        for(auto succ: block->succs()) {
+            bool seen = false;
+            for(auto pred: succ->preds) {
+                if(pred == block.get()) seen = true;
+            }
+            if(!seen) succ->preds.push_back(block.get());
+        }
+    }
+}
+
+/**
+* Counts the instructions in the function.
+*
+* @return The number of IR instructions
+*/
+int Function::countInsts() {
+    int count = 0;
+    for(auto &block: blocks) count += block->insts.size();
+    return count;
+}
+
+/**
+* Finds a function by name.
+*
+* @param name - The name of the procedure
+*
+* @return The function or nullptr if there is no such procedure
+*/
+Function *Module::getFunction(string name) {
+    for(auto &function: functions) {
+        if(function->name == name) return function.get();
+    }
+    return nullptr;
+}
+
+/**
+* Counts the instructions in every function of the module.
+*
+* @return The number of IR instructions
+*/
+int Module::countInsts() {
+    int count = 0;
+    for(auto &function: functions) count += function->countInsts();
+    return count;
+}
+
+/**
+* Returns the mnemonic used for an opcode in the IR dump.
+*
+* @param op - The opcode
+*
+* @return The name of the opcode
+*/
+string opcodeName(Opcode op) {
+    switch(op) {
+        case OP_CONST: return "const";
+        case OP_PARAM: return "param";
+        case OP_ADD: return "add";
+        case OP_SUB: return "sub";
+        case OP_MUL: return "mul";
+        case OP_DIV: return "div";
+        case OP_REM: return "rem";
+        case OP_MULHI: return "mulhi";
+        case OP_LT: return "lt";
+        case OP_LE: return "le";
+        case OP_GT: return "gt";
+        case OP_GE: return "ge";
+        case OP_EQ: return "eq";
+        case OP_NE: return "ne";
+        case OP_LOAD: return "load";
+        case OP_STORE: return "store";
+        case OP_SLOAD: return "sload";
+        case OP_SSTORE: return "sstore";
+        case OP_ADDR: return "addr";
+        case OP_CALL: return "call";
+        case OP_PRINT: return "print";
+        case OP_NEW: return "new";
+        case OP_DELETE: return "delete";
+        case OP_PHI: return "phi";
+        case OP_BR: return "br";
+        case OP_CONDBR: return "condbr";
+        case OP_RET: return "ret";
+    }
+    return "?";
+}
+
+/**
+* Returns the name of a block as it appears in the IR dump.
+*
+* @param block - The block
+*
+* @return The name followed by the block number
+*/
+string blockName(Block *block) { return block->name + to_string(block->id); }
+
+/**
+* Prints a function in a readable text form.
+*
+* @param function - The function to print
+* @param out - The stream to print to
+*/
+void dumpFunction(Function &function, ostream &out) {
+    out << "function " << function.name << "(";
+    for(int i = 0; i < function.params.size(); i++) {
+        out << (i ? ", " : "") << (function.params[i] == INT ? "int" : "int*");
+    }
+    out << ")" << endl;
+    for(int i = 0; i < function.slots.size(); i++) {
+        Slot &slot = function.slots[i];
+        out << "  slot " << slot.name << " : " << (slot.type == INT ? "int" : "int*");
+        if(slot.param >= 0) out << " (param " << slot.param << ")";
+        out << endl;
+    }
+    for(auto &block: function.blocks) {
+        out << blockName(block.get()) << ":";
+        if(!block->preds.empty()) {
+            out << "\t\t\t; preds:";
+            for(auto pred: block->preds) out << " " << blockName(pred);
+        }
+        out << endl;
+        for(auto &inst: block->insts) {
+            out << "  ";
+            if(inst.dst >= 0) {
+                out << "%" << inst.dst << ":" << (function.valueTypes[inst.dst] == INT ? "int" : "int*")
+                    << " = ";
+            }
+            out << opcodeName(inst.op);
+            if(inst.isUnsigned) out << "u";
+            if(inst.isExact) out << " exact";
+            if(inst.op == OP_CONST || inst.op == OP_PARAM) out << " " << inst.imm;
+            if(inst.op == OP_SLOAD || inst.op == OP_SSTORE || inst.op == OP_ADDR) {
+                out << " " << function.slots[inst.imm].name << (inst.args.empty() ? "" : ",");
+            }
+            if(inst.op == OP_CALL) out << " " << inst.callee;
+            if(inst.op == OP_PHI) {
+                for(int i = 0; i < inst.args.size(); i++) {
+                    out << (i ? ", " : " ") << "[%" << inst.args[i] << ", " << blockName(inst.blocks[i]) << "]";
+                }
+                out << endl;
+                continue;
+            }
+            for(int i = 0; i < inst.args.size(); i++) out << (i ? ", " : " ") << "%" << inst.args[i];
+            if((inst.op == OP_LOAD || inst.op == OP_STORE) && inst.imm) out << ", " << showpos << inst.imm << noshowpos;
+            for(int i = 0; i < inst.blocks.size(); i++) {
+                out << ((i || !inst.args.empty()) ? ", " : " ") << blockName(inst.blocks[i]);
+            }
+            out << endl;
+        }
+    }
+    out << endl;
+}
+
+/**
+* Prints every function of the module.
+*
+* @param module - The module to print
+* @param out - The stream to print to
+*/
+void dumpModule(Module &module, ostream &out) {
+    for(auto &function: module.functions) dumpFunction(*function, out);
+}
+
+/**
+* Checks the structural invariants of a function: every block ends in a single terminator,
+* phis come first and have one incoming value per predecessor, and every value is defined
+* exactly once.
+*
+* @param function - The function to check
+* @param out - Where problems are reported
+*
+* @return true if the function is well formed
+*/
+bool verifyFunction(Function &function, ostream &out) {
+    bool ok = true;
+    auto fail = [&](Block *block, string message) {
+        out << "ERROR: invalid IR in " << function.name << ", block " << blockName(block) << ": "
+            << message << endl;
+        ok = false;
+    };
+    vector<int> defs(function.valueTypes.size(), 0);
+    set<Block*> owned;
+    for(auto &block: function.blocks) owned.insert(block.get());
+    for(auto &block: function.blocks) {
+        if(block->insts.empty() || !block->terminator().isTerminator()) {
+            fail(block.get(), "missing terminator");
+            continue;
+        }
+        bool phis = true;
+        for(int i = 0; i < block->insts.size(); i++) {
+            Inst &inst = block->insts[i];
+            if(inst.isTerminator() && i != block->insts.size() - 1) fail(block.get(), "terminator in middle");
+            if(inst.op == OP_PHI) {
+                if(!phis) fail(block.get(), "phi after non-phi");
+                if(inst.args.size() != block->preds.size()) fail(block.get(), "phi does not match preds");
+                for(auto pred: inst.blocks) {
+                    bool found = false;
+                    for(auto p: block->preds) {
+                        if(p == pred) found = true;
+                    }
+                    if(!found) fail(block.get(), "phi names a block that is not a predecessor");
+                }
+            }
+            else phis = false;
+            if(inst.dst >= 0) {
+                if(inst.dst >= defs.size()) fail(block.get(), "value out of range");
+                else defs[inst.dst]++;
+            }
+            for(auto target: inst.blocks) {
+                if(!owned.count(target)) fail(block.get(), "branch to a block of another function");
+            }
+        }
+    }
+    for(int i = 0; i < defs.size(); i++) {
+        if(defs[i] > 1) {
+            out << "ERROR: invalid IR in " << function.name << ": %" << i << " defined twice" << endl;
+            ok = false;
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            for(auto arg: inst.args) {
+                if(arg < 0 || arg >= defs.size() || defs[arg] == 0) fail(block.get(), "use of undefined value");
+            }
+        }
+    }
+    return ok;
+}
+
+/**
+* Deletes the blocks that cannot be reached from the entry block and drops the phi inputs that
+* came from them.
+*
+* @param function - The function to clean up
+*/
+void removeUnreachableBlocks(Function &function) {
+    set<Block*> reachable;
+    vector<Block*> work = {function.entry()};
+    while(!work.empty()) {
+        Block *block = work.back();
+        work.pop_back();
+        if(reachable.count(block)) continue;
+        reachable.insert(block);
+        for(auto succ: block->succs()) work.push_back(succ);
+    }
+    vector<unique_ptr<Block>> kept;
+    for(auto &block: function.blocks) {
+        if(reachable.count(block.get())) kept.push_back(move(block));
+    }
+    function.blocks = move(kept);
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op != OP_PHI) continue;
+            for(int i = inst.args.size() - 1; i >= 0; i--) {
+                if(reachable.count(inst.blocks[i])) continue;
+                inst.args.erase(inst.args.begin() + i);
+                inst.blocks.erase(inst.blocks.begin() + i);
+            }
+        }
+    }
+    function.computePreds();
+}
+
+/**
+* Splits every edge that leaves a block with several successors and enters a block with several
+* predecessors, so that code for the edge (e.g. phi copies) has a block of its own.
+*
+* @param function - The function to transform
+*/
+void splitCriticalEdges(Function &function) {
+    function.computePreds();
+    int count = function.blocks.size();
+    for(int b = 0; b < count; b++) {
+        Block *block = function.blocks[b].get();
+        Inst &term = block->terminator();
+        if(term.op == OP_CONDBR && term.blocks[0] == term.blocks[1]) {
+            term.op = OP_BR;
+            term.args.clear();
+            term.blocks.pop_back();
+        }
+        if(term.blocks.size() < 2) continue;
+        for(auto &target: term.blocks) {
+            if(target->preds.size() < 2) continue;
+            Block *edge = function.newBlock("edge");
+            Inst br(OP_BR);
+            br.blocks.push_back(target);
+            edge->insts.push_back(br);
+            for(auto &inst: target->insts) {
+                if(inst.op != OP_PHI) continue;
+                for(auto &incoming: inst.blocks) {
+                    if(incoming == block) incoming = edge;
+                }
+            }
+            target = edge;
+        }
+    }
+    function.computePreds();
+}
+
+/**
+* Makes every instruction that uses one value use another one instead.
+*
+* @param function - The function to rewrite
+* @param from - The value being replaced
+* @param to - The value that replaces it
+*/
+void replaceAllUses(Function &function, int from, int to) {
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            for(auto &arg: inst.args) {
+                if(arg == from) arg = to;
+            }
+        }
+    }
+}
+
+/**
+* Finds the natural loops of a function from the back edges of a depth-first search; the CFGs
+* built from WLP4 are always reducible, so these are exactly the loops. Several back edges to the
+* same header form one loop.
+*
+* @param function - The function to analyze
+*
+* @return The blocks of every loop, by header
+*/
+map<Block*, set<Block*>> findLoops(Function &function) {
+    function.computePreds();
+    // depth-first search with an explicit stack of (block, next successor to visit)
+    set<Block*> visited = {function.entry()};
+    set<Block*> onStack = {function.entry()};
+    vector<pair<Block*, int>> stack = {{function.entry(), 0}};
+    vector<pair<Block*, Block*>> backEdges;
+    while(!stack.empty()) {
+        Block *block = stack.back().first;
+        vector<Block*> succs = block->succs();
+        if(stack.back().second == succs.size()) {
+            onStack.erase(block);
+            stack.pop_back();
+            continue;
+        }
+        Block *succ = succs[stack.back().second++];
+        if(onStack.count(succ)) backEdges.push_back({block, succ});
+        else if(!visited.count(succ)) {
+            visited.insert(succ);
+            onStack.insert(succ);
+            stack.push_back({succ, 0});
+        }
+    }
+    map<Block*, set<Block*>> loops;
+    for(auto &edge: backEdges) {
+        set<Block*> &body = loops[edge.second];
+        body.insert(edge.second);
+        vector<Block*> work = {edge.first};
+        while(!work.empty()) {
+            Block *block = work.back();
+            work.pop_back();
+            if(body.count(block)) continue;
+            body.insert(block);
+            for(auto pred: block->preds) work.push_back(pred);
+        }
+    }
+    return loops;
+}
+
+/**
+* Computes the immediate dominator of every block reachable from the entry (Cooper, Harvey and
+* Kennedy), iterating over the blocks in reverse postorder until nothing changes.
+*
+* @param function - The function to analyze
+*
+* @return The immediate dominator of every block; the entry block is its own
+*/
+map<Block*, Block*> computeDominators(Function &function) {
+    function.computePreds();
+    vector<Block*> postorder;
+    set<Block*> visited = {function.entry()};
+    vector<pair<Block*, int>> stack = {{function.entry(), 0}};
+    while(!stack.empty()) {
+        Block *block = stack.back().first;
+        vector<Block*> succs = block->succs();
+        if(stack.back().second == succs.size()) {
+            postorder.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+        Block *succ = succs[stack.back().second++];
+        if(visited.insert(succ).second) stack.push_back({succ, 0});
+    }
+    map<Block*, int> number;
+    for(int i = 0; i < postorder.size(); i++) number[postorder[i]] = i;
+    map<Block*, Block*> idom = {{function.entry(), function.entry()}};
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(int i = postorder.size() - 2; i >= 0; i--) {
+            Block *block = postorder[i];
+            Block *dom = nullptr;
+            for(auto pred: block->preds) {
+                if(!idom.count(pred)) continue;
+                if(!dom) {
+                    dom = pred;
+                    continue;
+                }
+                Block *other = pred;
+                while(dom != other) {
+                    while(number[dom] < number[other]) dom = idom[dom];
+                    while(number[other] < number[dom]) other = idom[other];
+                }
+            }
+            if(idom[block] != dom) {
+                idom[block] = dom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+/**
+* Checks if every path from the entry to a block goes through another one.
+*
+* @param idom - The immediate dominators, from computeDominators
+* @param a - The block that may dominate
+* @param b - The block that may be dominated
+*
+* @return true if a dominates b
+*/
+bool dominates(map<Block*, Block*> &idom, Block *a, Block *b) {
+    while(b != a) {
+        if(!idom.count(b) || idom[b] == b) return false;
+        b = idom[b];
+    }
+    return true;
+}
+
+/**
+* Computes how deeply each block is nested in loops.
+*
+* @param function - The function to analyze
+*
+* @return The loop depth of every block, 0 outside loops
+*/
+map<Block*, int> computeLoopDepth(Function &function) {
+    map<Block*, set<Block*>> loops = findLoops(function);
+    map<Block*, int> depth;
+    for(auto &block: function.blocks) depth[block.get()] = 0;
+    for(auto &loop: loops) {
+        for(auto block: loop.second) depth[block]++;
+    }
+    return depth;
+}
+
+/**
+* Finds the slots whose address is taken. The others are only ever read and written by SLOAD and
+* SSTORE, so no store through a pointer or call can change them.
+*
+* @param function - The function to analyze
+*
+* @return The slots used by an ADDR
+*/
+set<int> findAddressTakenSlots(Function &function) {
+    set<int> slots;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_ADDR) slots.insert(inst.imm);
+        }
+    }
+    return slots;
+}
+
+/**
+* Removes the phis whose value is never used other than by phis that are not needed either, e.g.
+* those of a variable that is not read after the loop assigning it.
+*
+* @param function - The function to clean up
+*/
+void removeDeadPhis(Function &function) {
+    map<int, Inst*> phis;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_PHI) phis[inst.dst] = &inst;
+        }
+    }
+    set<int> needed;
+    vector<int> work;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_PHI) continue;
+            for(auto arg: inst.args) {
+                if(phis.count(arg) && needed.insert(arg).second) work.push_back(arg);
+            }
+        }
+    }
+    while(!work.empty()) {
+        Inst *phi = phis[work.back()];
+        work.pop_back();
+        for(auto arg: phi->args) {
+            if(phis.count(arg) && needed.insert(arg).second) work.push_back(arg);
+        }
+    }
+    for(auto &block: function.blocks) {
+        vector<Inst> kept;
+        for(auto &inst: block->insts) {
+            if(inst.op != OP_PHI || needed.count(inst.dst)) kept.push_back(inst);
+        }
+        block->insts = kept;
+    }
+}
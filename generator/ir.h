@@ -0,0 +1,126 @@
+#ifndef IR_H
+#define IR_H
+
+#include <map>
+#include <set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+enum Type {
+    INT=0, INT_STAR,
+};
+
+/*
+ * Mid-level IR built per procedure from the AST.
+ *
+ * A Function is a list of basic blocks forming an explicit control flow graph. Every block ends
+ * in exactly one terminator (BR, CONDBR or RET). Values are virtual registers numbered per
+ * function; each is defined by exactly one instruction (SSA), and PHI instructions at the top
+ * of a block merge values coming from its predecessors. Local variables and parameters live in
+ * stack slots that are accessed with SLOAD/SSTORE and whose address is taken with ADDR.
+ */
+enum Opcode {
+    OP_CONST,       // dst = imm
+    OP_PARAM,       // dst = incoming argument number imm
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_REM,
+    OP_MULHI,       // dst = high word of the 64-bit signed product args[0] * args[1]
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_LOAD,        // dst = *(args[0] + imm)
+    OP_STORE,       // *(args[1] + imm) = args[0]
+    OP_SLOAD,       // dst = slot imm
+    OP_SSTORE,      // slot imm = args[0]
+    OP_ADDR,        // dst = &slot imm
+    OP_CALL,        // dst = callee(args...)
+    OP_PRINT,       // println(args[0])
+    OP_NEW,         // dst = new int[args[0]]
+    OP_DELETE,      // delete [] args[0]
+    OP_PHI,         // dst = phi(args[i] from blocks[i])
+    OP_BR,          // goto blocks[0]
+    OP_CONDBR,      // if args[0] goto blocks[0] else blocks[1]
+    OP_RET,         // return args[0]
+};
+
+class Block;
+
+class Inst {
+	public:
+		Opcode op;
+		int dst = -1;
+		vector<int> args;
+		vector<Block*> blocks;
+		int imm = 0;
+		string callee;
+		// comparisons of int* operands are unsigned
+		bool isUnsigned = false;
+		// the division is known to leave no remainder (pointer differences)
+		bool isExact = false;
+
+		Inst(Opcode op) : op{op} {}
+
+		bool isTerminator() const;
+		bool hasSideEffects() const;
+		bool isCompare() const;
+};
+
+class Block {
+	public:
+		int id;
+		string name;
+		vector<Inst> insts;
+		vector<Block*> preds;
+
+		Inst &terminator();
+		vector<Block*> succs();
+};
+
+// A stack slot holding a local variable or a parameter.
+struct Slot {
+    string name;
+    Type type;
+    // index of the parameter that initializes the slot, -1 for locals
+    int param;
+};
+
+class Function {
+	public:
+		string name;
+		vector<Type> params;
+		vector<Slot> slots;
+		vector<unique_ptr<Block>> blocks;
+		// type of every value, indexed by value number
+		vector<Type> valueTypes;
+		int blockCount = 0;
+
+		Block *newBlock(string);
+		int newValue(Type);
+		Block *entry();
+		void computePreds();
+		int countInsts();
+};
+
+class Module {
+	public:
+		vector<unique_ptr<Function>> functions;
+
+		Function *getFunction(string);
+		int countInsts();
+};
+
+string opcodeName(Opcode);
+void dumpFunction(Function&, ostream&);
+void dumpModule(Module&, ostream&);
+bool verifyFunction(Function&, ostream&);
+void removeUnreachableBlocks(Function&);
+void splitCriticalEdges(Function&);
+void replaceAllUses(Function&, int, int);
+map<Block*, set<Block*>> findLoops(Function&);
+map<Block*, Block*> computeDominators(Function&);
+bool dominates(map<Block*, Block*>&, Block*, Block*);
+map<Block*, int> computeLoopDepth(Function&);
+set<int> findAddressTakenSlots(Function&);
+void removeDeadPhis(Function&);
+
+#endif
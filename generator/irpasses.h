@@ -0,0 +1,24 @@
+#ifndef IRPASSES_H
+#define IRPASSES_H
+
+#include "ir.h"
+using namespace std;
+
+bool simplifyCFG(Function&);
+bool propagateConstants(Function&);
+bool removeDeadValues(Function&);
+bool foldBinary(const Inst&, int, int, int&);
+bool reduceStrength(Function&);
+bool divideByConstants(Function&);
+bool eliminateTailRecursion(Function&);
+bool eliminateCommonSubexpressions(Function&);
+bool hoistLoopInvariants(Function&);
+bool convertIfs(Function&);
+bool promoteSlots(Function&);
+bool eliminateRedundantLoads(Function&);
+bool rotateLoops(Function&);
+bool removeDeadProcedures(Module&);
+bool inlineProcedures(Module&);
+int exactLog2(int);
+
+#endif
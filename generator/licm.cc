@@ -0,0 +1,251 @@
+#include "irpasses.h"
+#include "passes.h"
+#include <algorithm>
+
+/**
+* Checks if an instruction is cheaper to repeat than to keep in a frame slot across a loop:
+* constants, loads of slots (often just a register) and slot addresses. These are not hoisted on
+* their own, only copied in front of the loop when a hoisted instruction reads them.
+*
+* @param inst - The instruction
+*
+* @return true if the instruction is only copied as an operand
+*/
+static bool isCheap(const Inst &inst) {
+    return inst.op == OP_CONST || inst.op == OP_SLOAD || inst.op == OP_ADDR;
+}
+
+/**
+* Moves the computations of WHILE loops that give the same value on every iteration into a
+* preheader, a block that runs once before the loop is entered.
+*/
+class LoopInvariantMotion {
+	public:
+		LoopInvariantMotion(Function &function) : function{function} {}
+		bool run();
+	private:
+		Function &function;
+		map<int, Inst*> definitions;
+		map<Inst*, Block*> parent;
+		set<int> addressTaken;
+
+		Block *makePreheader(Block*, set<Block*>&);
+		bool hoist(Block*, set<Block*>&);
+};
+
+/**
+* Finds or creates the block that all entries into a loop come from. If the header has a single
+* predecessor outside the loop and it branches nowhere else, that block is used; otherwise a new
+* block takes over those edges, and the phis of the header merge the values coming from outside
+* in it.
+*
+* @param header - The header of the loop
+* @param body - The blocks of the loop
+*
+* @return The preheader
+*/
+Block *LoopInvariantMotion::makePreheader(Block *header, set<Block*> &body) {
+    vector<Block*> outside;
+    for(auto pred: header->preds) {
+        if(!body.count(pred)) outside.push_back(pred);
+    }
+    if(outside.size() == 1 && outside[0]->succs().size() == 1) return outside[0];
+    Block *preheader = function.newBlock("preheader");
+    for(auto pred: outside) {
+        for(auto &target: pred->terminator().blocks) {
+            if(target == header) target = preheader;
+        }
+    }
+    for(auto &inst: header->insts) {
+        if(inst.op != OP_PHI) break;
+        Inst merge(OP_PHI);
+        merge.dst = function.newValue(function.valueTypes[inst.dst]);
+        for(int i = inst.args.size() - 1; i >= 0; i--) {
+            if(body.count(inst.blocks[i])) continue;
+            merge.args.insert(merge.args.begin(), inst.args[i]);
+            merge.blocks.insert(merge.blocks.begin(), inst.blocks[i]);
+            inst.args.erase(inst.args.begin() + i);
+            inst.blocks.erase(inst.blocks.begin() + i);
+        }
+        preheader->insts.push_back(merge);
+        inst.args.push_back(merge.dst);
+        inst.blocks.push_back(preheader);
+    }
+    Inst enter(OP_BR);
+    enter.blocks = {header};
+    preheader->insts.push_back(enter);
+    // lay the preheader out right before the header
+    auto position = find_if(function.blocks.begin(), function.blocks.end(), [&](unique_ptr<Block> &block) { return block.get() == header; });
+    rotate(position, function.blocks.end() - 1, function.blocks.end());
+    function.computePreds();
+    return preheader;
+}
+
+/**
+* Hoists the invariant instructions of one loop. An instruction is invariant if it has no side
+* effects and its operands are defined outside the loop or are invariant themselves. Loads of
+* memory are invariant only if the loop stores nothing through a pointer or to a slot whose
+* address is taken, and calls no procedure;
+* loads of a slot, only if the loop does not store to it and, when its address is taken, could
+* not change it through a pointer either. Loads and divisions that may trap are only hoisted
+* from blocks that run whenever the loop is entered.
+*
+* @param header - The header of the loop
+* @param body - The blocks of the loop
+*
+* @return true if any instruction was hoisted
+*/
+bool LoopInvariantMotion::hoist(Block *header, set<Block*> &body) {
+    bool clobbersMemory = false;
+    set<int> storedSlots;
+    vector<Block*> exits;
+    for(auto block: body) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_STORE || inst.op == OP_CALL || inst.op == OP_NEW || inst.op == OP_DELETE) clobbersMemory = true;
+            // a pointer may point to a slot whose address is taken, so storing to it changes memory
+            if(inst.op == OP_SSTORE && addressTaken.count(inst.imm)) clobbersMemory = true;
+            if(inst.op == OP_SSTORE) storedSlots.insert(inst.imm);
+        }
+        for(auto succ: block->succs()) {
+            if(!body.count(succ)) exits.push_back(block);
+        }
+    }
+    map<Block*, Block*> idom = computeDominators(function);
+    auto alwaysRuns = [&](Block *block) {
+        for(auto exit: exits) {
+            if(!dominates(idom, block, exit)) return false;
+        }
+        return true;
+    };
+    auto isInvariant = [&](Inst &inst, set<Inst*> &invariant) {
+        if(inst.dst < 0 || inst.hasSideEffects() || inst.op == OP_PHI || inst.op == OP_CALL || inst.op == OP_NEW) return false;
+        for(auto arg: inst.args) {
+            Inst *def = definitions[arg];
+            if(body.count(parent[def]) && !invariant.count(def)) return false;
+        }
+        if(inst.op == OP_SLOAD) {
+            if(storedSlots.count(inst.imm)) return false;
+            return !addressTaken.count(inst.imm) || !clobbersMemory;
+        }
+        bool traps = inst.op == OP_LOAD;
+        if(inst.op == OP_DIV || inst.op == OP_REM) {
+            Inst *divisor = definitions[inst.args[1]];
+            traps = divisor->op != OP_CONST || divisor->imm == 0;
+        }
+        if(inst.op == OP_LOAD && clobbersMemory) return false;
+        return !traps || alwaysRuns(parent[&inst]);
+    };
+
+    // invariant instructions in an order where operands come first
+    set<Inst*> invariant;
+    vector<Inst*> order;
+    bool progress = true;
+    while(progress) {
+        progress = false;
+        for(auto &block: function.blocks) {
+            if(!body.count(block.get())) continue;
+            for(auto &inst: block->insts) {
+                if(invariant.count(&inst) || !isInvariant(inst, invariant)) continue;
+                invariant.insert(&inst);
+                order.push_back(&inst);
+                progress = true;
+            }
+        }
+    }
+    // only instructions that are worth keeping in a slot are hoisted, with the cheap ones they
+    // read copied along
+    set<Inst*> hoisted;
+    for(int i = order.size() - 1; i >= 0; i--) {
+        Inst *inst = order[i];
+        if(!isCheap(*inst)) hoisted.insert(inst);
+        if(!hoisted.count(inst)) continue;
+        for(auto arg: inst->args) {
+            if(invariant.count(definitions[arg])) hoisted.insert(definitions[arg]);
+        }
+    }
+    if(hoisted.empty()) return false;
+
+    Block *preheader = makePreheader(header, body);
+    vector<Inst> moved;
+    map<int, int> copies;
+    for(auto inst: order) {
+        if(!hoisted.count(inst)) continue;
+        Inst copy = *inst;
+        for(auto &arg: copy.args) {
+            if(copies.count(arg)) arg = copies[arg];
+        }
+        if(isCheap(copy)) {
+            copy.dst = copies[inst->dst] = function.newValue(function.valueTypes[inst->dst]);
+            moved.push_back(copy);
+            continue;
+        }
+        moved.push_back(copy);
+    }
+    for(auto &block: function.blocks) {
+        if(!body.count(block.get())) continue;
+        vector<Inst> kept;
+        for(auto &inst: block->insts) {
+            if(!hoisted.count(&inst) || isCheap(inst)) kept.push_back(inst);
+        }
+        block->insts = kept;
+    }
+    preheader->insts.insert(preheader->insts.end() - 1, moved.begin(), moved.end());
+    PassManager::recordStatistic("licm", "instructions hoisted", moved.size() - copies.size());
+    return true;
+}
+
+/**
+* Processes the loops from the innermost out, so that what is hoisted out of an inner loop into
+* its preheader can then be hoisted out of the enclosing loop as well.
+*
+* @return true if the function was changed
+*/
+bool LoopInvariantMotion::run() {
+    map<Block*, set<Block*>> loops = findLoops(function);
+    vector<pair<int, Block*>> order;
+    for(auto &loop: loops) order.push_back({loop.second.size(), loop.first});
+    sort(order.begin(), order.end());
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_ADDR) addressTaken.insert(inst.imm);
+        }
+    }
+    bool changed = false;
+    for(auto &loop: order) {
+        Block *header = loop.second;
+        definitions.clear();
+        parent.clear();
+        for(auto &block: function.blocks) {
+            for(auto &inst: block->insts) {
+                if(inst.dst >= 0) definitions[inst.dst] = &inst;
+                parent[&inst] = block.get();
+            }
+        }
+        int blocks = function.blocks.size();
+        if(!hoist(header, loops[header])) continue;
+        changed = true;
+        if(function.blocks.size() == blocks) continue;
+        // a new preheader belongs to the loops that enclose this one
+        Block *preheader = header->preds[0];
+        for(auto pred: header->preds) {
+            if(!loops[header].count(pred)) preheader = pred;
+        }
+        for(auto &other: loops) {
+            if(other.first != header && other.second.count(header)) other.second.insert(preheader);
+        }
+    }
+    if(changed) removeDeadValues(function);
+    return changed;
+}
+
+/**
+* Hoists loop-invariant computations out of loops.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool hoistLoopInvariants(Function &function) {
+    LoopInvariantMotion licm(function);
+    return licm.run();
+}
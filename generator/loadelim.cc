@@ -0,0 +1,304 @@
+#include "irpasses.h"
+#include "passes.h"
+#include <algorithm>
+#include <tuple>
+
+// what a load or store accesses: a slot (-1 for memory), the pointer the address is computed
+// from (-1 for slots), and the byte offset from the start of either
+typedef tuple<int, int, int> Location;
+
+/**
+* Removes loads whose result is already known: the location was loaded before, or a value was
+* stored to it, and nothing since may have changed it. A store followed by a load of the same
+* location thereby becomes a copy of the stored value, which also covers assignments to and reads
+* of variables whose address is taken. The locations known on entry to a block are those known
+* at the end of all its predecessors (a must-availability problem solved over the loops), and
+* the values they hold on the different paths are merged by new phis.
+*
+* An address is split into a root and a constant offset, by following additions and subtractions
+* of constants back to the address of a slot or to some other pointer. Two locations may refer
+* to the same word unless:
+*   - they are in different slots, or at different offsets of the same slot or pointer;
+*   - one is a slot whose address is never taken, and the other is not that slot;
+*   - one is a slot and the other is based on the result of new, which never points to a slot;
+*   - both are based on the results of different news (or the same one at different offsets).
+* Any other two pointers may be equal. A store forgets every location it may alias, and then
+* knows the value stored. A call forgets everything but the slots whose address is not taken,
+* and delete forgets every location in memory; new and println forget nothing.
+*/
+class LoadElimination {
+	public:
+		LoadElimination(Function &function) : function{function} {}
+		bool run();
+	private:
+		Function &function;
+		set<int> addressTaken;
+		// values defined by new
+		set<int> heap;
+		// pointers some address is based on
+		set<int> bases;
+		map<int, Inst*> definitions;
+		// value -> the block defining it
+		map<int, Block*> owners;
+		map<int, Location> origins;
+		// removed load or phi -> the value its uses read instead
+		map<int, int> replacement;
+
+		Location locate(int, int);
+		bool mayAlias(const Location&, const Location&);
+		void transfer(Block*, map<Location, int>&, bool);
+		int resolve(int);
+};
+
+/**
+* Finds the location a pointer plus a constant offset refers to.
+*
+* @param pointer - The pointer
+* @param offset - The constant byte offset added to it
+*
+* @return The location
+*/
+Location LoadElimination::locate(int pointer, int offset) {
+    if(!origins.count(pointer)) {
+        Inst *def = definitions.count(pointer) ? definitions[pointer] : nullptr;
+        auto isConstant = [&](int value) { return definitions.count(value) && definitions[value]->op == OP_CONST; };
+        Location origin(-1, pointer, 0);
+        if(def && def->op == OP_ADDR) origin = Location(def->imm, -1, 0);
+        else if(def && def->op == OP_ADD && isConstant(def->args[1])) origin = locate(def->args[0], definitions[def->args[1]]->imm);
+        else if(def && def->op == OP_ADD && isConstant(def->args[0])) origin = locate(def->args[1], definitions[def->args[0]]->imm);
+        else if(def && def->op == OP_SUB && isConstant(def->args[1])) origin = locate(def->args[0], -definitions[def->args[1]]->imm);
+        origins[pointer] = origin;
+        if(get<1>(origin) >= 0) bases.insert(get<1>(origin));
+    }
+    Location origin = origins[pointer];
+    get<2>(origin) += offset;
+    return origin;
+}
+
+/**
+* Checks if two locations may be the same word of memory, by the rules above.
+*
+* @param a - One location
+* @param b - The other location
+*
+* @return true unless they are known to be different
+*/
+bool LoadElimination::mayAlias(const Location &a, const Location &b) {
+    int slotA = get<0>(a), slotB = get<0>(b), baseA = get<1>(a), baseB = get<1>(b);
+    if(slotA >= 0 && slotB >= 0) return slotA == slotB && get<2>(a) == get<2>(b);
+    if(slotA >= 0) return addressTaken.count(slotA) && !heap.count(baseB);
+    if(slotB >= 0) return addressTaken.count(slotB) && !heap.count(baseA);
+    if(baseA == baseB) return get<2>(a) == get<2>(b);
+    return !heap.count(baseA) || !heap.count(baseB);
+}
+
+/**
+* Updates the known locations across a block.
+*
+* @param block - The block
+* @param known - The value of each known location; updated to those at the end of the block
+* @param remove - true to record the loads whose result is known as removed
+*/
+void LoadElimination::transfer(Block *block, map<Location, int> &known, bool remove) {
+    auto forget = [&](auto clobbered) {
+        for(auto it = known.begin(); it != known.end();) {
+            if(clobbered(it->first)) it = known.erase(it);
+            else ++it;
+        }
+    };
+    for(auto &inst: block->insts) {
+        // a pointer defined again in a loop points somewhere else
+        if(inst.dst >= 0 && bases.count(inst.dst)) forget([&](const Location &location) { return get<1>(location) == inst.dst; });
+        if(inst.op == OP_LOAD || inst.op == OP_SLOAD) {
+            Location location = inst.op == OP_LOAD ? locate(inst.args[0], inst.imm) : Location(inst.imm, -1, 0);
+            auto it = known.find(location);
+            if(it == known.end() || function.valueTypes[it->second] != function.valueTypes[inst.dst]) known[location] = inst.dst;
+            else if(remove) replacement[inst.dst] = it->second;
+        }
+        else if(inst.op == OP_STORE || inst.op == OP_SSTORE) {
+            Location location = inst.op == OP_STORE ? locate(inst.args[1], inst.imm) : Location(inst.imm, -1, 0);
+            forget([&](const Location &other) { return mayAlias(location, other); });
+            known[location] = inst.args[0];
+        }
+        else if(inst.op == OP_CALL) forget([&](const Location &location) { return get<0>(location) < 0 || addressTaken.count(get<0>(location)); });
+        else if(inst.op == OP_DELETE) forget([&](const Location &location) { return get<0>(location) < 0; });
+    }
+}
+
+/**
+* Follows the replacements of a value to the value that is kept.
+*
+* @param value - The value
+*
+* @return The value its uses should read
+*/
+int LoadElimination::resolve(int value) {
+    while(replacement.count(value)) value = replacement[value];
+    return value;
+}
+
+/**
+* Finds the known locations by iterating over the blocks in reverse postorder until nothing
+* changes, then walks the blocks once more giving each location a value, with a phi wherever
+* several predecessors meet. The loads whose result is known from another block are then
+* removed, as are the phis that merge a single value or that nothing reads.
+*
+* @return true if the function was changed
+*/
+bool LoadElimination::run() {
+    removeUnreachableBlocks(function);
+    addressTaken = findAddressTakenSlots(function);
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.dst >= 0) definitions[inst.dst] = &inst;
+            if(inst.dst >= 0) owners[inst.dst] = block.get();
+            if(inst.op == OP_NEW) heap.insert(inst.dst);
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_LOAD) locate(inst.args[0], inst.imm);
+            if(inst.op == OP_STORE) locate(inst.args[1], inst.imm);
+        }
+    }
+    vector<Block*> order;
+    set<Block*> visited = {function.entry()};
+    vector<pair<Block*, int>> stack = {{function.entry(), 0}};
+    while(!stack.empty()) {
+        Block *block = stack.back().first;
+        vector<Block*> succs = block->succs();
+        if(stack.back().second == succs.size()) {
+            order.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+        Block *succ = succs[stack.back().second++];
+        if(visited.insert(succ).second) stack.push_back({succ, 0});
+    }
+    reverse(order.begin(), order.end());
+
+    // the locations known on entry to and at the end of each block; blocks not reached yet know
+    // everything
+    map<Block*, map<Location, int>> in, out;
+    auto sameLocations = [](map<Location, int> &a, map<Location, int> &b) {
+        if(a.size() != b.size()) return false;
+        for(auto ia = a.begin(), ib = b.begin(); ia != a.end(); ++ia, ++ib) {
+            if(ia->first != ib->first) return false;
+        }
+        return true;
+    };
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(auto block: order) {
+            map<Location, int> known;
+            bool first = true;
+            for(auto pred: block->preds) {
+                if(block == function.entry() || !out.count(pred)) continue;
+                if(first) known = out[pred];
+                else {
+                    for(auto it = known.begin(); it != known.end();) {
+                        if(out[pred].count(it->first)) ++it;
+                        else it = known.erase(it);
+                    }
+                }
+                first = false;
+            }
+            in[block] = known;
+            transfer(block, known, false);
+            if(out.count(block) && sameLocations(out[block], known)) continue;
+            out[block] = known;
+            changed = true;
+        }
+    }
+
+    // the phis merging the values of the known locations, by block
+    map<Block*, vector<pair<Inst, Location>>> merges;
+    out.clear();
+    for(auto block: order) {
+        map<Location, int> known;
+        if(block != function.entry() && block->preds.size() == 1) known = out[block->preds[0]];
+        else if(block != function.entry()) {
+            Block *dom = nullptr;
+            for(auto pred: block->preds) {
+                if(!dom && out.count(pred)) dom = pred;
+            }
+            for(auto &entry: in[block]) {
+                Inst phi(OP_PHI);
+                phi.dst = known[entry.first] = function.newValue(function.valueTypes[out[dom][entry.first]]);
+                owners[phi.dst] = block;
+                merges[block].push_back({phi, entry.first});
+            }
+        }
+        transfer(block, known, true);
+        out[block] = known;
+    }
+    if(replacement.empty()) return false;
+
+    for(auto &merge: merges) {
+        for(auto &phi: merge.second) {
+            for(auto pred: merge.first->preds) {
+                phi.first.args.push_back(out[pred][phi.second]);
+                phi.first.blocks.push_back(pred);
+            }
+        }
+    }
+    // a phi whose operands are all one value (or itself) is that value
+    changed = true;
+    while(changed) {
+        changed = false;
+        for(auto &merge: merges) {
+            for(auto &phi: merge.second) {
+                if(replacement.count(phi.first.dst)) continue;
+                set<int> values;
+                for(auto arg: phi.first.args) {
+                    if(resolve(arg) != phi.first.dst) values.insert(resolve(arg));
+                }
+                if(values.size() != 1) continue;
+                replacement[phi.first.dst] = *values.begin();
+                changed = true;
+            }
+        }
+    }
+    // a value used twice within a block is kept in the frame, which costs as much as loading it
+    // again; only values from other blocks, which can be kept in registers, replace loads
+    map<int, int> resolved;
+    for(auto &entry: replacement) resolved[entry.first] = resolve(entry.first);
+    int removed = 0;
+    for(auto &entry: resolved) {
+        bool isLoad = definitions.count(entry.first);
+        if(isLoad && owners[entry.second] == owners[entry.first]) replacement.erase(entry.first);
+        else replacement[entry.first] = entry.second;
+        if(isLoad && replacement.count(entry.first)) removed++;
+    }
+    if(!removed) return false;
+    for(auto &block: function.blocks) {
+        vector<Inst> kept;
+        for(auto &phi: merges[block.get()]) {
+            if(!replacement.count(phi.first.dst)) kept.push_back(phi.first);
+        }
+        for(auto &inst: block->insts) {
+            if(inst.dst < 0 || !replacement.count(inst.dst)) kept.push_back(inst);
+        }
+        for(auto &inst: kept) {
+            for(auto &arg: inst.args) arg = resolve(arg);
+        }
+        block->insts = kept;
+    }
+    removeDeadPhis(function);
+    removeDeadValues(function);
+    PassManager::recordStatistic("load-elim", "loads removed", removed);
+    return true;
+}
+
+/**
+* Removes loads of locations whose value is already known from an earlier load or store.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool eliminateRedundantLoads(Function &function) {
+    LoadElimination elimination(function);
+    return elimination.run();
+}
@@ -0,0 +1,86 @@
+#include "irpasses.h"
+#include "passes.h"
+
+// loop tests with more IR instructions than this are not copied
+static const int MAX_TEST_SIZE = 16;
+
+/**
+* Rotates a loop so that its test is at the bottom. The header, which holds the test of a WHILE
+* loop, is copied to the end of every block that branches back to it; the header itself is then
+* only run once, on entry, as a guard, and each iteration ends in a single conditional branch
+* back to the body instead of an unconditional branch to the test and a conditional one out.
+*
+* @param function - The function holding the loop
+* @param header - The header of the loop
+* @param body - The blocks of the loop
+*
+* @return true if the loop was rotated
+*/
+static bool rotateLoop(Function &function, Block *header, set<Block*> &body) {
+    Inst &test = header->terminator();
+    if(test.op != OP_CONDBR || header->insts.size() > MAX_TEST_SIZE) return false;
+    if(body.count(test.blocks[0]) == body.count(test.blocks[1])) return false;
+    // the copies define new values, so those of the header must not be needed anywhere else
+    set<int> defined;
+    for(auto &inst: header->insts) {
+        if(inst.op == OP_PHI) return false;
+        if(inst.dst >= 0) defined.insert(inst.dst);
+    }
+    for(auto &block: function.blocks) {
+        if(block.get() == header) continue;
+        for(auto &inst: block->insts) {
+            for(auto arg: inst.args) {
+                if(defined.count(arg)) return false;
+            }
+        }
+    }
+    vector<Block*> latches;
+    for(auto pred: header->preds) {
+        if(!body.count(pred)) continue;
+        if(pred->terminator().op != OP_BR) return false;
+        latches.push_back(pred);
+    }
+    for(auto latch: latches) {
+        latch->insts.pop_back();
+        map<int, int> values;
+        for(auto inst: header->insts) {
+            for(auto &arg: inst.args) {
+                if(values.count(arg)) arg = values[arg];
+            }
+            if(inst.dst >= 0) inst.dst = values[inst.dst] = function.newValue(function.valueTypes[inst.dst]);
+            latch->insts.push_back(inst);
+        }
+        // the latch is a new predecessor of both targets of the test
+        for(auto target: test.blocks) {
+            for(auto &inst: target->insts) {
+                if(inst.op != OP_PHI) break;
+                for(int i = 0; i < inst.blocks.size(); i++) {
+                    if(inst.blocks[i] != header) continue;
+                    inst.args.push_back(inst.args[i]);
+                    inst.blocks.push_back(latch);
+                    break;
+                }
+            }
+        }
+    }
+    function.computePreds();
+    return true;
+}
+
+/**
+* Rotates every loop whose header is a small test that decides whether to run the body or leave,
+* i.e. the loops built for WHILE.
+*
+* @param function - The function to optimize
+*
+* @return true if any loop was rotated
+*/
+bool rotateLoops(Function &function) {
+    map<Block*, set<Block*>> loops = findLoops(function);
+    int rotated = 0;
+    for(auto &loop: loops) {
+        if(rotateLoop(function, loop.first, loop.second)) rotated++;
+    }
+    if(rotated) PassManager::recordStatistic("loop-rotate", "loops rotated", rotated);
+    return rotated > 0;
+}
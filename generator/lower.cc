@@ -0,0 +1,1195 @@
+#include "lower.h"
+#include "parallel.h"
+#include "regalloc.h"
+#include "irpasses.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+// registers that hold temporaries, in the order they are handed out; all are caller-saved
+static const vector<int> TEMPORARIES = {3, 5, 6, 7, 8, 9, 1};
+// a register for values that are needed only within one instruction's code
+static const int SCRATCH = 2;
+// owner of a register that holds an operand of the instruction being lowered
+static const int OPERAND = -2;
+// registers that pass the first arguments of a call; the others go on the stack
+static const vector<int> ARGUMENTS = {1, 2, 6, 7};
+// caller-saved registers a leaf may keep slots in instead of $12-$28, in order of preference
+static const vector<int> LEAF_SLOT_REGISTERS = {1, 9, 8, 7, 6, 5};
+// temporaries a leaf keeps for itself when it moves slots out of $12-$28
+static const int MIN_LEAF_TEMPORARIES = 4;
+// instructions that write the register named by their first operand
+static const set<string> WRITES_FIRST = {"add", "sub", "slt", "sltu", "lw", "lis", "mfhi", "mflo"};
+
+/**
+* Returns the assembly name of a register.
+*
+* @param r - The register number
+*
+* @return The register written as "$r"
+*/
+string reg(int r) { return "$" + to_string(r); }
+
+/**
+* Returns the time elapsed since a point, for the timing of the passes done by the lowering.
+*
+* @param start - The point
+*
+* @return The time in milliseconds
+*/
+static double millisecondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Lowers every function of the module. wain comes first, right after the prologue, so that
+* execution starts in it; the other procedures follow in source order. The functions are lowered
+* in parallel and concatenated in that order. The time each worker spends in the passes the
+* lowering implements is added up in passTimes.
+*
+* @param module - The module to lower
+*
+* @return The generated program
+*/
+vector<Instruction> Lowering::lower(Module &module) {
+    program.clear();
+    generatePrologue();
+    vector<Function*> order;
+    Function *wain = module.getFunction("wain");
+    if(wain) order.push_back(wain);
+    for(auto &function: module.functions) {
+        if(function.get() != wain) order.push_back(function.get());
+    }
+    vector<vector<Instruction>> code(order.size());
+    vector<map<string, double>> times(order.size());
+    parallelFor(order.size(), threads, [&](int i) {
+        Lowering worker;
+        worker.allocateRegisters = allocateRegisters;
+        worker.tailCalls = tailCalls;
+        worker.fuseBranches = fuseBranches;
+        worker.module = &module;
+        code[i] = worker.lowerFunction(*order[i]);
+        times[i] = worker.passTimes;
+    });
+    passTimes.clear();
+    for(auto &part: code) program.insert(program.end(), part.begin(), part.end());
+    for(auto &part: times) {
+        for(auto &time: part) passTimes[time.first] += time.second;
+    }
+    return program;
+}
+
+/**
+* Sets how many functions are lowered at the same time.
+*
+* @param count - The number of threads
+*/
+void Lowering::setThreads(int count) { threads = count; }
+
+/**
+* Returns the time spent in each pass the lowering implements, summed over the threads.
+*
+* @return The time in milliseconds, by pass name
+*/
+map<string, double> Lowering::getPassTimes() { return passTimes; }
+
+/**
+* Turns register allocation for locals and parameters on or off.
+*
+* @param on - true to keep slots in $12-$28 where possible
+*/
+void Lowering::setRegisterAllocation(bool on) { allocateRegisters = on; }
+
+/**
+* Turns jumping to procedures called in tail position on or off.
+*
+* @param on - true to reuse the caller's frame for tail calls
+*/
+void Lowering::setTailCalls(bool on) { tailCalls = on; }
+
+/**
+* Turns lowering comparisons that only decide a branch into the branch itself on or off.
+*
+* @param on - true to fuse such comparisons with their branch
+*/
+void Lowering::setBranchFusion(bool on) { fuseBranches = on; }
+
+/**
+* Appends an instruction to the program. Nothing is emitted while the lowering is only counting
+* the spill slots it needs.
+*
+* @param op - The mnemonic or directive
+* @param args - The operands
+*/
+void Lowering::emit(string op, vector<string> args) {
+    // a register that is written no longer holds the constant it was loaded with
+    if(op == "jalr") constants.clear();
+    else if(WRITES_FIRST.count(op)) constants.erase(stoi(args[0].substr(1)));
+    if(!dryRun) program.push_back(Instruction(op, args));
+}
+
+/**
+* Appends a label to the program.
+*
+* @param name - The name of the label
+*/
+void Lowering::emitLabel(string name) {
+    // code can branch here with other values in the registers
+    constants.clear();
+    if(!dryRun) program.push_back(Instruction::makeLabel(name));
+}
+
+/**
+* Returns a label that is unique within the program.
+*
+* @param label - The stem of the label
+*
+* @return The stem, a number that has not been used in the function yet and the function name
+*/
+string Lowering::getUniqueLabel(string label) {
+    ++labelCount;
+    return label + to_string(labelCount) + "in" + function->name;
+}
+
+/**
+* Returns the label of a block, creating it the first time it is asked for.
+*
+* @param block - The block
+*
+* @return The label of the block
+*/
+string Lowering::label(Block *block) {
+    if(!labels.count(block)) labels[block] = getUniqueLabel(block->name);
+    return labels[block];
+}
+
+/**
+* Asm for pushing a value onto the stack.
+*
+* @param r - The register to push
+*/
+void Lowering::push(int r) {
+    emit("sw", {reg(r), "-4", reg(30)});
+    emit("sub", {reg(30), reg(30), reg(4)});
+}
+
+/**
+* Moves $30 by a number of words: down to allocate them, up to free them. Up to two words it is
+* moved one word at a time with $4; beyond that the size is loaded into $5 and the move takes a
+* single add or sub. $5 must be free: it only ever holds the address of a procedure being called
+* and temporaries, which are dead wherever the stack is adjusted.
+*
+* @param words - The number of words to allocate, or to free if negative
+*/
+void Lowering::adjustStack(int words) {
+    string op = words > 0 ? "sub" : "add";
+    words = abs(words);
+    if(words <= 2) {
+        for(int i = 0; i < words; i++) emit(op, {reg(30), reg(30), reg(4)});
+        return;
+    }
+    emit("lis", {reg(5)});
+    emit(".word", {to_string(4 * words)});
+    emit(op, {reg(30), reg(30), reg(5)});
+}
+
+/**
+* Pop a value from the stack into a register.
+*
+* @param r - The register to pop into
+*/
+void Lowering::pop(int r) {
+    emit("add", {reg(30), reg(30), reg(4)});
+    emit("lw", {reg(r), "-4", reg(30)});
+}
+
+/**
+* Saves $31 in its frame slot, on entry to a function that makes calls.
+*/
+void Lowering::saveReturnAddress() {
+    emit("sw", {reg(31), to_string(returnOffset), reg(frameRegister)});
+}
+
+/**
+* Restores $31 from its frame slot before returning.
+*/
+void Lowering::restoreReturnAddress() {
+    emit("lw", {reg(31), to_string(returnOffset), reg(frameRegister)});
+}
+
+/**
+* Loads a constant into a register.
+*
+* @param r - The register to load
+* @param value - The value of the constant
+*/
+void Lowering::constantGenerator(int r, int value) {
+    emit("lis", {reg(r)});
+    emit(".word", {to_string(value)});
+    constants[r] = value;
+}
+
+/**
+* Calls one of the runtime procedures (print, init, new, delete). $31 must have been saved.
+* print is called through $10, which the prologue loads with its address.
+*
+* @param name - The name of the runtime procedure
+*/
+void Lowering::callRuntime(string name) {
+    if(name == "print") {
+        emit("jalr", {reg(10)});
+        return;
+    }
+    emit("lis", {reg(5)});
+    emit(".word", {name});
+    emit("jalr", {reg(5)});
+}
+
+/**
+* Generates the program prologue: imports and the registers that hold constants for the whole
+* program ($4 = 4, $10 = print, $11 = 1).
+*/
+void Lowering::generatePrologue() {
+    for(string name: {"print", "init", "new", "delete"}) emit(".import", {name});
+    constantGenerator(4, 4);
+    emit("lis", {reg(10)});
+    emit(".word", {"print"});
+    constantGenerator(11, 1);
+}
+
+/**
+* Generates the return sequence of the current function: restores the callee-saved registers,
+* $31, $30 and the caller's $29, and returns to $31.
+*/
+void Lowering::generateEpilogue() {
+    popFrame();
+    emit("jr", {reg(31)});
+}
+
+/**
+* Undoes the prologue of the current function: the callee-saved registers and $31 are restored,
+* $30 is set back to where it was on entry, one word above $29, and $29 is reloaded from the word
+* it was saved in. A leaf moved neither.
+*/
+void Lowering::popFrame() {
+    for(auto &save: saveOffset) emit("lw", {reg(save.first), to_string(save.second), reg(frameRegister)});
+    if(makesCalls) restoreReturnAddress();
+    if(frameRegister == 30) return;
+    emit("add", {reg(30), reg(29), reg(4)});
+    if(function->name != "wain") emit("lw", {reg(29), "-4", reg(30)});
+}
+
+/**
+* Gives every edge from a conditional branch into a block with phis a block of its own, so the
+* phi copies for the edge run only when the edge is taken. The new blocks are laid out right
+* after the branch, which can then fall through into one of them.
+*/
+void Lowering::splitPhiEdges() {
+    for(int b = 0; b < function->blocks.size(); b++) {
+        Block *block = function->blocks[b].get();
+        Inst &term = block->terminator();
+        if(term.op != OP_CONDBR) continue;
+        for(auto &target: term.blocks) {
+            if(target->insts.empty() || target->insts[0].op != OP_PHI) continue;
+            Block *edge = function->newBlock("edge");
+            Inst br(OP_BR);
+            br.blocks.push_back(target);
+            edge->insts.push_back(br);
+            for(auto &inst: target->insts) {
+                if(inst.op != OP_PHI) continue;
+                for(auto &incoming: inst.blocks) {
+                    if(incoming == block) incoming = edge;
+                }
+            }
+            target = edge;
+            unique_ptr<Block> moved = move(function->blocks.back());
+            function->blocks.pop_back();
+            function->blocks.insert(function->blocks.begin() + ++b, move(moved));
+        }
+    }
+    function->computePreds();
+}
+
+/**
+* Decides which values are temporaries: values with a single use in the block that defines them.
+* The blocks are then lowered once without emitting anything to count the spill slots needed.
+*/
+void Lowering::classifyValues() {
+    uses.clear();
+    alias.clear();
+    map<int, Block*> defBlock;
+    map<int, Block*> useBlock;
+    set<int> phiValues;
+    set<int> otherBlock;
+    for(auto &block: function->blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.dst >= 0) defBlock[inst.dst] = block.get();
+            if(inst.op == OP_PHI) phiValues.insert(inst.dst);
+            // an instruction that reads a value twice (x + x) uses it once
+            for(auto arg: set<int>(inst.args.begin(), inst.args.end())) uses[arg]++;
+            for(auto arg: inst.args) {
+                if(useBlock.count(arg) && useBlock[arg] != block.get()) otherBlock.insert(arg);
+                useBlock[arg] = block.get();
+                if(inst.op == OP_PHI) phiValues.insert(arg);
+            }
+        }
+    }
+    findAliases();
+    for(auto value: phiValues) alias.erase(value);
+    for(auto value: otherBlock) alias.erase(value);
+    for(auto &value: defBlock) {
+        if(useBlock.count(value.first) && useBlock[value.first] != value.second) alias.erase(value.first);
+    }
+    // 0, 1 and 4 are read from the registers that always hold them, in any block
+    for(auto &block: function->blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CONST && PINNED.count(inst.imm) && !phiValues.count(inst.dst)) alias[inst.dst] = PINNED.at(inst.imm);
+        }
+    }
+
+    temps.clear();
+    for(auto &use: uses) {
+        int value = use.first;
+        if(alias.count(value)) continue;
+        if(use.second == 1 && !phiValues.count(value) && defBlock[value] == useBlock[value]) {
+            temps.insert(value);
+        }
+    }
+
+    spillCount = 0;
+    dryRun = true;
+    for(auto &block: function->blocks) lowerBlock(block.get(), nullptr);
+    dryRun = false;
+}
+
+/**
+* Finds the loads of slots that live in registers and can read the register directly instead of
+* copying it: the register must not be written between the load and the last use in the block,
+* by the slot or by another slot that shares the register. The
+* caller removes the values that are also used in other blocks or by phis.
+*/
+void Lowering::findAliases() {
+    for(auto &block: function->blocks) {
+        map<int, int> loadSlot, loadPos, lastUse;
+        vector<pair<int, int>> stores;
+        for(int i = 0; i < block->insts.size(); i++) {
+            Inst &inst = block->insts[i];
+            for(auto arg: inst.args) lastUse[arg] = i;
+            if(inst.op == OP_SSTORE && slotRegister.count(inst.imm)) stores.push_back({i, slotRegister[inst.imm]});
+            if(inst.op == OP_SLOAD && slotRegister.count(inst.imm)) {
+                loadSlot[inst.dst] = inst.imm;
+                loadPos[inst.dst] = i;
+            }
+        }
+        for(auto &load: loadSlot) {
+            int value = load.first;
+            bool ok = true;
+            for(auto &store: stores) {
+                if(store.second != slotRegister[load.second] || !lastUse.count(value)) continue;
+                if(store.first > loadPos[value] && store.first < lastUse[value]) ok = false;
+            }
+            if(ok) alias[value] = slotRegister[load.second];
+        }
+    }
+}
+
+/**
+* Assigns frame offsets to slots, home slots, saved registers and spill slots. The caller's $29
+* is saved at 0($29), except in wain. Parameters passed on the stack stay where the caller pushed
+* them; the parameters passed in registers, the locals that did not get a register, the home
+* slots, the callee-saved registers, $31 and the spill slots are allocated below $29.
+*
+* A leaf procedure, one that calls nothing, sets up neither $29 nor $30: nothing else can use the
+* stack while it runs, so its frame is addressed from $30 and left unallocated below it.
+*/
+void Lowering::layoutFrame() {
+    slotOffset.clear();
+    homeOffset.clear();
+    frameRegister = makesCalls ? 29 : 30;
+    // $29 is one word below $30
+    int above = frameRegister == 30 ? -4 : 0;
+    int words = function->name == "wain" ? 0 : 1;
+    int numParams = function->params.size();
+    for(int i = 0; i < function->slots.size(); i++) {
+        Slot &slot = function->slots[i];
+        if(slot.param >= (int)ARGUMENTS.size()) slotOffset[i] = 4 * (numParams - slot.param) + above;
+        else if(!slotRegister.count(i)) slotOffset[i] = -4 * words++;
+    }
+    for(auto &use: uses) {
+        if(!temps.count(use.first) && !alias.count(use.first)) homeOffset[use.first] = -4 * words++;
+    }
+    // wain returns to the loader, which does not need its registers preserved
+    saveOffset.clear();
+    if(function->name != "wain") {
+        set<int> used;
+        for(auto &slot: slotRegister) used.insert(slot.second);
+        for(auto r: used) {
+            if(r >= FIRST_SLOT_REGISTER) saveOffset[r] = -4 * words++;
+        }
+    }
+    returnOffset = 0;
+    if(makesCalls) returnOffset = -4 * words++;
+    spillBase = -4 * words;
+    words += spillCount;
+    frameSize = words;
+}
+
+/**
+* Lowers a function: prologue, then every block in layout order.
+*
+* @param f - The function to lower
+*
+* @return The code of the function
+*/
+vector<Instruction> Lowering::lowerFunction(Function &f) {
+    program.clear();
+    function = &f;
+    splitPhiEdges();
+    slotRegister.clear();
+    auto start = chrono::steady_clock::now();
+    if(allocateRegisters) demoteValues(f);
+    passTimes["regalloc"] += millisecondsSince(start);
+    makesCalls = f.name == "wain";
+    set<int> read;
+    for(auto &block: f.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CALL || inst.op == OP_PRINT || inst.op == OP_NEW || inst.op == OP_DELETE) makesCalls = true;
+            if(inst.op == OP_SLOAD || inst.op == OP_ADDR) read.insert(inst.imm);
+            if(inst.op != OP_PARAM) continue;
+            for(int i = 0; i < f.slots.size(); i++) {
+                if(f.slots[i].param == inst.imm) read.insert(i);
+            }
+        }
+    }
+    temporaries = TEMPORARIES;
+    start = chrono::steady_clock::now();
+    if(allocateRegisters) {
+        slotRegister = allocateSlotRegisters(f);
+        // the blocks left holding nothing but a branch are bypassed
+        if(removeCoalescedCopies(f, slotRegister)) simplifyCFG(f);
+    }
+    passTimes["regalloc"] += millisecondsSince(start);
+    if(!makesCalls) useCallerSavedRegisters();
+    classifyValues();
+    layoutFrame();
+
+    emitLabel("F" + f.name);
+    if(frameRegister == 29) {
+        if(f.name != "wain") emit("sw", {reg(29), "-4", reg(30)});
+        emit("sub", {reg(29), reg(30), reg(4)});
+        adjustStack(frameSize);
+    }
+    if(makesCalls) saveReturnAddress();
+    for(auto &save: saveOffset) emit("sw", {reg(save.first), to_string(save.second), reg(frameRegister)});
+    // parameters arrive in the argument registers (wain's in $1 and $2, from the loader) or on the
+    // stack; those never read need not be moved anywhere
+    for(int i = 0; i < f.slots.size(); i++) {
+        int param = f.slots[i].param;
+        if(param < 0 || !read.count(i)) continue;
+        if(param >= ARGUMENTS.size()) {
+            if(slotRegister.count(i)) emit("lw", {reg(slotRegister[i]), to_string(slotOffset[i]), reg(frameRegister)});
+        }
+        else if(slotRegister.count(i)) emit("add", {reg(slotRegister[i]), reg(ARGUMENTS[param]), reg(0)});
+        else emit("sw", {reg(ARGUMENTS[param]), to_string(slotOffset[i]), reg(frameRegister)});
+    }
+    if(f.name == "wain") {
+        // if program is called with twoints, put 0 in $2
+        if(f.params.size() > 0 && f.params[0] == INT) emit("add", {reg(2), reg(0), reg(0)});
+        callRuntime("init");
+    }
+    for(int i = 0; i < f.blocks.size(); i++) {
+        Block *next = i + 1 < f.blocks.size() ? f.blocks[i + 1].get() : nullptr;
+        lowerBlock(f.blocks[i].get(), next);
+    }
+    return program;
+}
+
+/**
+* Moves the slots of a leaf procedure from callee-saved registers to caller-saved ones, which
+* need no saving as long as nothing is called. Each register taken leaves the pool of
+* temporaries, down to MIN_LEAF_TEMPORARIES. A parameter stays in the register it arrives in
+* when it can; other slots avoid the registers that still hold parameters on entry, so that the
+* prologue can copy them in any order.
+*/
+void Lowering::useCallerSavedRegisters() {
+    // the slots sharing each callee-saved register, parameters first
+    map<int, vector<int>> sharing;
+    vector<int> order;
+    for(int pass = 0; pass < 2; pass++) {
+        for(auto &slot: slotRegister) {
+            bool param = function->slots[slot.first].param >= 0;
+            if(param != (pass == 0)) continue;
+            if(sharing[slot.second].empty() && find(order.begin(), order.end(), slot.second) == order.end()) order.push_back(slot.second);
+            sharing[slot.second].push_back(slot.first);
+        }
+    }
+    set<int> incoming, taken;
+    for(int i = 0; i < function->params.size() && i < ARGUMENTS.size(); i++) incoming.insert(ARGUMENTS[i]);
+    map<int, int> renamed;
+    for(auto r: order) {
+        if(temporaries.size() - taken.size() <= MIN_LEAF_TEMPORARIES) break;
+        int param = -1;
+        for(auto slot: sharing[r]) param = max(param, function->slots[slot].param);
+        int target = -1;
+        for(auto candidate: LEAF_SLOT_REGISTERS) {
+            if(taken.count(candidate)) continue;
+            if(param >= 0 && param < ARGUMENTS.size() && candidate == ARGUMENTS[param]) {
+                target = candidate;
+                break;
+            }
+            if(target < 0 && (param < 0 || !incoming.count(candidate))) target = candidate;
+        }
+        if(target < 0) continue;
+        taken.insert(target);
+        renamed[r] = target;
+    }
+    for(auto &slot: slotRegister) {
+        if(renamed.count(slot.second)) slot.second = renamed[slot.second];
+    }
+    vector<int> pool;
+    for(auto r: temporaries) {
+        if(!taken.count(r)) pool.push_back(r);
+    }
+    temporaries = pool;
+}
+
+/**
+* Lowers one block.
+*
+* @param block - The block to lower
+* @param next - The block that is laid out after it, or nullptr
+*/
+void Lowering::lowerBlock(Block *block, Block *next) {
+    spillSlot.clear();
+    location.clear();
+    live.clear();
+    for(int r = 0; r < 32; r++) owner[r] = -1;
+    forgetCaches();
+    bool targeted = block != function->entry();
+    if(targeted) emitLabel(label(block));
+    for(int i = 0; i < block->insts.size(); i++) {
+        Inst &inst = block->insts[i];
+        if(inst.op == OP_PHI) continue;
+        auto start = chrono::steady_clock::now();
+        bool tailCall = isTailCall(block, i);
+        if(tailCall) lowerTailCall(inst);
+        passTimes["tail-calls"] += millisecondsSince(start);
+        if(tailCall) return;
+        start = chrono::steady_clock::now();
+        bool fused = isFusedCompare(block, i);
+        if(fused) lowerCompareBranch(inst, block->terminator(), next);
+        passTimes["branch-fusion"] += millisecondsSince(start);
+        if(fused) return;
+        if(inst.isTerminator()) lowerTerminator(inst, next);
+        else lowerInst(inst);
+    }
+}
+
+/**
+* Forgets which home slots and constants the temporary registers still hold, e.g. after a call.
+*/
+void Lowering::forgetCaches() {
+    for(int r = 0; r < 32; r++) cached[r] = -1;
+    constants.clear();
+}
+
+/**
+* Returns a register from the pool of temporaries. Free registers that hold nothing useful are
+* preferred, then free registers holding a copy of a home slot or a constant; when every register
+* is taken, the oldest temporary is spilled. Aborts if every register is an operand of the
+* current instruction.
+*
+* @param avoid - Registers that must not be returned (operands of the current instruction)
+*
+* @return The register
+*/
+int Lowering::allocate(set<int> avoid) {
+    for(auto r: temporaries) {
+        if(!avoid.count(r) && owner[r] == -1 && cached[r] < 0 && !constants.count(r)) return r;
+    }
+    for(auto r: temporaries) {
+        if(avoid.count(r) || owner[r] != -1) continue;
+        cached[r] = -1;
+        return r;
+    }
+    for(auto value: live) {
+        int r = location[value];
+        if(avoid.count(r)) continue;
+        spill(value);
+        return r;
+    }
+    // every instruction needs fewer registers than the pool has, so this is a bug in the lowering;
+    // carrying on would overwrite a live value and silently produce a wrong program
+    cerr << "ERROR: internal lowering error in " << function->name << ": out of registers" << endl;
+    abort();
+}
+
+/**
+* Makes sure a specific register is free, spilling the temporary it holds.
+*
+* @param r - The register
+*
+* @return The register
+*/
+int Lowering::take(int r) {
+    if(owner[r] >= 0) spill(owner[r]);
+    owner[r] = -1;
+    cached[r] = -1;
+    return r;
+}
+
+/**
+* Returns the frame offset of a spill slot.
+*
+* @param k - The spill slot
+*
+* @return Its offset from $29
+*/
+int Lowering::spillOffset(int k) { return spillBase - 4 * k; }
+
+/**
+* Stores a temporary held in a register to the lowest free spill slot and frees the register.
+*
+* @param value - The temporary
+*/
+void Lowering::spill(int value) {
+    int r = location[value];
+    set<int> taken;
+    for(auto &spilled: spillSlot) taken.insert(spilled.second);
+    int k = 0;
+    while(taken.count(k)) k++;
+    spillCount = max(spillCount, k + 1);
+    emit("sw", {reg(r), to_string(spillOffset(k)), reg(frameRegister)});
+    spillSlot[value] = k;
+    owner[r] = -1;
+    location.erase(value);
+    live.erase(find(live.begin(), live.end(), value));
+}
+
+/**
+* Spills every temporary held in a register except the given ones. Used before calls, since the
+* callee may change any register outside $12-$28.
+*
+* @param keep - The operands of the call
+*/
+void Lowering::spillExcept(vector<int> keep) {
+    vector<int> values = live;
+    for(auto value: values) {
+        if(find(keep.begin(), keep.end(), value) == keep.end()) spill(value);
+    }
+}
+
+/**
+* Loads the operands of an instruction into registers. Temporaries already in registers and
+* slots held in registers are used where they are; spilled temporaries are loaded from their
+* spill slots and the other values from their home slots. An operand with a target is then moved
+* to that register.
+*
+* @param values - The operands
+* @param targets - The register each operand must end up in, or -1 for any register
+*
+* @return The register each operand is in
+*/
+vector<int> Lowering::fetch(vector<int> values, vector<int> targets) {
+    int n = values.size();
+    vector<int> regs(n, -1);
+    set<int> busy;
+    for(int i = 0; i < n; i++) {
+        int value = values[i];
+        if(alias.count(value)) regs[i] = alias[value];
+        else if(location.count(value)) regs[i] = location[value];
+        else {
+            for(auto r: temporaries) {
+                if(cached[r] == value && owner[r] == -1) regs[i] = r;
+            }
+            if(regs[i] >= 0) owner[regs[i]] = OPERAND;
+        }
+        if(regs[i] >= 0) busy.insert(regs[i]);
+    }
+    for(int i = 0; i < n; i++) {
+        if(regs[i] >= 0) continue;
+        int value = values[i];
+        int first = find(values.begin(), values.end(), value) - values.begin();
+        if(first < i) {
+            regs[i] = regs[first];
+            continue;
+        }
+        int r = allocate(busy);
+        if(spillSlot.count(value)) {
+            emit("lw", {reg(r), to_string(spillOffset(spillSlot[value])), reg(frameRegister)});
+            spillSlot.erase(value);
+        }
+        else {
+            emit("lw", {reg(r), to_string(homeOffset[value]), reg(frameRegister)});
+            cached[r] = value;
+        }
+        owner[r] = OPERAND;
+        regs[i] = r;
+        busy.insert(r);
+    }
+    for(int i = 0; i < n; i++) {
+        int t = targets[i];
+        if(t < 0 || regs[i] == t) continue;
+        take(t);
+        emit("add", {reg(t), reg(regs[i]), reg(0)});
+        release({values[i]}, {regs[i]});
+        owner[t] = OPERAND;
+        regs[i] = t;
+    }
+    return regs;
+}
+
+/**
+* Frees the registers of operands once an instruction has read them. Every temporary has a
+* single use, so it dies here.
+*
+* @param values - The operands
+* @param regs - The registers they were fetched into
+*/
+void Lowering::release(vector<int> values, vector<int> regs) {
+    for(int i = 0; i < values.size(); i++) {
+        if(alias.count(values[i])) continue;
+        owner[regs[i]] = -1;
+        if(location.count(values[i]) && location[values[i]] == regs[i]) {
+            location.erase(values[i]);
+            live.erase(find(live.begin(), live.end(), values[i]));
+        }
+    }
+}
+
+/**
+* Records that an instruction left its result in a register. Temporaries stay there until they
+* are used; other values are stored to their home slot, and the register keeps a copy.
+*
+* @param value - The value that was computed
+* @param r - The register holding it
+*/
+void Lowering::define(int value, int r) {
+    cached[r] = -1;
+    if(!uses.count(value)) return;
+    if(homeOffset.count(value)) {
+        emit("sw", {reg(r), to_string(homeOffset[value]), reg(frameRegister)});
+        cached[r] = value;
+        return;
+    }
+    owner[r] = value;
+    location[value] = r;
+    live.push_back(value);
+}
+
+/**
+* Returns a register for a constant: a free temporary register that still holds it from earlier
+* in the block if there is one, so that it is not loaded again, or else a new one.
+*
+* @param value - The constant
+*
+* @return The register
+*/
+int Lowering::constantRegister(int value) {
+    for(auto r: temporaries) {
+        if(owner[r] != -1 || !constants.count(r) || constants[r] != value) continue;
+        cached[r] = -1;
+        return r;
+    }
+    return allocate({});
+}
+
+/**
+* Lowers an instruction that is not a terminator.
+*
+* @param inst - The instruction
+*/
+void Lowering::lowerInst(Inst &inst) {
+    // the register is read directly by the instructions that use the value
+    if((inst.op == OP_SLOAD || inst.op == OP_CONST) && alias.count(inst.dst)) return;
+    if(inst.op == OP_CALL) {
+        lowerCall(inst);
+        return;
+    }
+    bool runtime = inst.op == OP_PRINT || inst.op == OP_NEW || inst.op == OP_DELETE;
+    if(runtime) spillExcept(inst.args);
+    vector<int> r = fetch(inst.args, vector<int>(inst.args.size(), runtime ? 1 : -1));
+    release(inst.args, r);
+    int d = -1;
+    if(inst.op == OP_NEW) d = take(3);
+    else if(inst.op == OP_CONST) d = constantRegister(inst.imm);
+    else if(inst.dst >= 0) d = allocate({});
+    string what = inst.isUnsigned ? "sltu" : "slt";
+    switch(inst.op) {
+        case OP_CONST:
+            if(!constants.count(d) || constants[d] != inst.imm) constantGenerator(d, inst.imm);
+            break;
+        case OP_PARAM:
+            for(int i = 0; i < function->slots.size(); i++) {
+                if(function->slots[i].param == inst.imm) emit("lw", {reg(d), to_string(slotOffset[i]), reg(frameRegister)});
+            }
+            break;
+        case OP_SLOAD:
+            if(slotRegister.count(inst.imm)) emit("add", {reg(d), reg(slotRegister[inst.imm]), reg(0)});
+            else emit("lw", {reg(d), to_string(slotOffset[inst.imm]), reg(frameRegister)});
+            break;
+        case OP_SSTORE:
+            if(!slotRegister.count(inst.imm)) emit("sw", {reg(r[0]), to_string(slotOffset[inst.imm]), reg(frameRegister)});
+            else if(r[0] != slotRegister[inst.imm]) emit("add", {reg(slotRegister[inst.imm]), reg(r[0]), reg(0)});
+            break;
+        case OP_ADDR:
+            constantGenerator(d, slotOffset[inst.imm]);
+            emit("add", {reg(d), reg(d), reg(frameRegister)});
+            break;
+        case OP_LOAD:
+            emit("lw", {reg(d), to_string(inst.imm), reg(r[0])});
+            break;
+        case OP_STORE:
+            emit("sw", {reg(r[0]), to_string(inst.imm), reg(r[1])});
+            break;
+        case OP_ADD:
+        case OP_SUB:
+            emit(inst.op == OP_ADD ? "add" : "sub", {reg(d), reg(r[0]), reg(r[1])});
+            break;
+        case OP_MUL:
+            emit("mult", {reg(r[0]), reg(r[1])});
+            emit("mflo", {reg(d)});
+            break;
+        case OP_DIV:
+        case OP_REM:
+            emit("div", {reg(r[0]), reg(r[1])});
+            emit(inst.op == OP_DIV ? "mflo" : "mfhi", {reg(d)});
+            break;
+        case OP_MULHI:
+            emit("mult", {reg(r[0]), reg(r[1])});
+            emit("mfhi", {reg(d)});
+            break;
+        case OP_LT:
+            emit(what, {reg(d), reg(r[0]), reg(r[1])});
+            break;
+        case OP_GT:
+            emit(what, {reg(d), reg(r[1]), reg(r[0])});
+            break;
+        case OP_GE:
+            emit(what, {reg(d), reg(r[0]), reg(r[1])});
+            emit("sub", {reg(d), reg(11), reg(d)});
+            break;
+        case OP_LE:
+            emit(what, {reg(d), reg(r[1]), reg(r[0])});
+            emit("sub", {reg(d), reg(11), reg(d)});
+            break;
+        case OP_EQ:
+        case OP_NE:
+            // d may be one of the operands, so it is written last
+            emit("slt", {reg(SCRATCH), reg(r[1]), reg(r[0])});
+            emit("slt", {reg(d), reg(r[0]), reg(r[1])});
+            emit("add", {reg(d), reg(d), reg(SCRATCH)});
+            if(inst.op == OP_EQ) emit("sub", {reg(d), reg(11), reg(d)});
+            break;
+        case OP_PRINT:
+            callRuntime("print");
+            break;
+        case OP_NEW: {
+            callRuntime("new");
+            string label = getUniqueLabel("newOk");
+            emit("bne", {reg(3), reg(0), label});
+            emit("add", {reg(3), reg(11), reg(0)});
+            emitLabel(label);
+            break;
+        }
+        case OP_DELETE: {
+            string label = getUniqueLabel("skipDelete");
+            emit("beq", {reg(1), reg(11), label});
+            callRuntime("delete");
+            emitLabel(label);
+            break;
+        }
+        default:
+            break;
+    }
+    if(runtime) forgetCaches();
+    if(inst.dst >= 0) define(inst.dst, d);
+}
+
+/**
+* Returns the number of arguments of a call that are passed on the stack.
+*
+* @param n - The number of arguments
+*
+* @return The number of arguments after those passed in registers
+*/
+static int stackArguments(int n) { return max(0, n - (int)ARGUMENTS.size()); }
+
+/**
+* Returns the register an operand can be read from without loading it: the register of a slot or
+* pinned constant, that of a temporary, or a free one that still holds a copy of its home slot.
+*
+* @param value - The operand
+*
+* @return The register, or -1 if the value is only in memory
+*/
+int Lowering::registerHolding(int value) {
+    if(alias.count(value)) return alias[value];
+    if(location.count(value)) return location[value];
+    for(auto r: temporaries) {
+        if(cached[r] == value && owner[r] == -1) return r;
+    }
+    return -1;
+}
+
+/**
+* Loads an operand that is only in memory from its spill slot or home slot.
+*
+* @param r - The register to load
+* @param value - The operand
+*/
+void Lowering::loadOperand(int r, int value) {
+    int offset = spillSlot.count(value) ? spillOffset(spillSlot[value]) : homeOffset[value];
+    emit("lw", {reg(r), to_string(offset), reg(frameRegister)});
+}
+
+/**
+* Puts the first arguments of a call in the argument registers. The values may sit in other
+* argument registers, so a copy is only made once no other copy still has to read its target;
+* when the copies form a cycle, one target is first moved aside to $5. The values that are only
+* in memory are loaded last.
+*
+* @param values - The arguments passed in registers
+*/
+void Lowering::moveArguments(vector<int> values) {
+    vector<pair<int, int>> moves;
+    vector<int> loads;
+    for(int k = 0; k < values.size(); k++) {
+        int r = registerHolding(values[k]);
+        if(r < 0) loads.push_back(k);
+        else if(r != ARGUMENTS[k]) moves.push_back({r, ARGUMENTS[k]});
+    }
+    while(!moves.empty()) {
+        int ready = -1;
+        for(int i = 0; i < moves.size() && ready < 0; i++) {
+            ready = i;
+            for(auto &move: moves) {
+                if(move.first == moves[i].second) ready = -1;
+            }
+        }
+        if(ready < 0) {
+            int r = moves[0].second;
+            emit("add", {reg(5), reg(r), reg(0)});
+            for(auto &move: moves) {
+                if(move.first == r) move.first = 5;
+            }
+            continue;
+        }
+        emit("add", {reg(moves[ready].second), reg(moves[ready].first), reg(0)});
+        moves.erase(moves.begin() + ready);
+    }
+    for(auto k: loads) loadOperand(ARGUMENTS[k], values[k]);
+}
+
+/**
+* Lowers a call to a WLP4 procedure. The arguments past the argument registers are pushed, then
+* the others are put in those registers. The callee saves and restores $29 itself, and $31 was
+* saved on entry, so nothing else is kept around the call.
+*
+* @param inst - The call
+*/
+void Lowering::lowerCall(Inst &inst) {
+    vector<int> &args = inst.args;
+    spillExcept(args);
+    int inRegisters = args.size() - stackArguments(args.size());
+    for(int k = inRegisters; k < args.size(); k++) {
+        int r = registerHolding(args[k]);
+        if(r < 0) loadOperand(r = SCRATCH, args[k]);
+        push(r);
+    }
+    moveArguments(vector<int>(args.begin(), args.begin() + inRegisters));
+    for(auto value: args) {
+        if(location.count(value)) release({value}, {location[value]});
+        spillSlot.erase(value);
+    }
+    emit("lis", {reg(5)});
+    emit(".word", {"F" + inst.callee});
+    emit("jalr", {reg(5)});
+    adjustStack(-stackArguments(args.size()));
+    forgetCaches();
+    define(inst.dst, take(3));
+}
+
+/**
+* Checks if an instruction is a call whose result is returned right away, to a procedure that
+* takes no more stack arguments than the current one has room for. wain's caller is the loader,
+* so it makes no tail calls, and neither do procedures that take the address of a slot, which
+* may be passed to the callee after the frame holding it is popped.
+*
+* @param block - The block holding the instruction
+* @param i - The position of the instruction in the block
+*
+* @return true if the call can be lowered as a jump
+*/
+bool Lowering::isTailCall(Block *block, int i) {
+    if(!tailCalls || function->name == "wain" || i + 2 != block->insts.size()) return false;
+    Inst &call = block->insts[i], &ret = block->insts[i + 1];
+    if(call.op != OP_CALL || ret.op != OP_RET || ret.args[0] != call.dst) return false;
+    for(auto &other: function->blocks) {
+        for(auto &inst: other->insts) {
+            if(inst.op == OP_ADDR) return false;
+        }
+    }
+    Function *callee = module->getFunction(call.callee);
+    return callee && stackArguments(callee->params.size()) <= stackArguments(function->params.size());
+}
+
+/**
+* Lowers a call in tail position. The stack arguments overwrite the current procedure's own,
+* where the callee expects them relative to the same $30, and the others go in the argument
+* registers. The frame is then popped as in a return, restoring $31, and the jump leaves it
+* alone, so the callee returns straight to our caller.
+*
+* @param inst - The call
+*/
+void Lowering::lowerTailCall(Inst &inst) {
+    int n = inst.args.size(), inRegisters = n - stackArguments(n);
+    set<int> stored;
+    for(int k = inRegisters; k < n; k++) {
+        int value = inst.args[k];
+        if(!stored.insert(value).second) continue;
+        vector<int> r = fetch({value}, {-1});
+        for(int j = k; j < n; j++) {
+            if(inst.args[j] == value) emit("sw", {reg(r[0]), to_string(4 * (n - j)), reg(frameRegister)});
+        }
+        release({value}, r);
+    }
+    moveArguments(vector<int>(inst.args.begin(), inst.args.begin() + inRegisters));
+    popFrame();
+    emit("lis", {reg(5)});
+    emit(".word", {"F" + inst.callee});
+    emit("jr", {reg(5)});
+}
+
+/**
+* Stores the values flowing along the edge from one block into the phis of its successor. The
+* copies happen in parallel: all incoming values are loaded before any phi is written, into
+* registers if there are few enough of them and into spill slots otherwise.
+*
+* @param from - The block the edge leaves
+* @param to - The block the edge enters
+*/
+void Lowering::copyPhis(Block *from, Block *to) {
+    vector<int> phis, values;
+    for(auto &inst: to->insts) {
+        if(inst.op != OP_PHI) break;
+        if(!homeOffset.count(inst.dst)) continue;
+        for(int i = 0; i < inst.blocks.size(); i++) {
+            if(inst.blocks[i] == from) {
+                phis.push_back(inst.dst);
+                values.push_back(inst.args[i]);
+            }
+        }
+    }
+    if(values.size() <= temporaries.size()) {
+        vector<int> r = fetch(values, vector<int>(values.size(), -1));
+        for(int i = 0; i < phis.size(); i++) emit("sw", {reg(r[i]), to_string(homeOffset[phis[i]]), reg(frameRegister)});
+        release(values, r);
+        return;
+    }
+    spillCount = max(spillCount, (int)values.size());
+    for(int i = 0; i < values.size(); i++) {
+        emit("lw", {reg(3), to_string(homeOffset[values[i]]), reg(frameRegister)});
+        emit("sw", {reg(3), to_string(spillOffset(i)), reg(frameRegister)});
+    }
+    for(int i = 0; i < phis.size(); i++) {
+        emit("lw", {reg(3), to_string(spillOffset(i)), reg(frameRegister)});
+        emit("sw", {reg(3), to_string(homeOffset[phis[i]]), reg(frameRegister)});
+    }
+}
+
+/**
+* Lowers the branch or return that ends a block. Branches to the block laid out next fall through.
+*
+* @param inst - The terminator
+* @param next - The block laid out after the current one, or nullptr
+*/
+void Lowering::lowerTerminator(Inst &inst, Block *next) {
+    if(inst.op == OP_RET) {
+        fetch(inst.args, {3});
+        generateEpilogue();
+        return;
+    }
+    if(inst.op == OP_BR) {
+        Block *from = nullptr;
+        for(auto &block: function->blocks) {
+            if(!block->insts.empty() && &block->terminator() == &inst) from = block.get();
+        }
+        copyPhis(from, inst.blocks[0]);
+        if(inst.blocks[0] != next) emit("beq", {reg(0), reg(0), label(inst.blocks[0])});
+        return;
+    }
+    vector<int> r = fetch(inst.args, {-1});
+    if(inst.blocks[1] == next) {
+        emit("bne", {reg(r[0]), reg(0), label(inst.blocks[0])});
+        return;
+    }
+    emit("beq", {reg(r[0]), reg(0), label(inst.blocks[1])});
+    if(inst.blocks[0] != next) emit("beq", {reg(0), reg(0), label(inst.blocks[0])});
+}
+
+/**
+* Checks if an instruction is a comparison whose only use is the conditional branch right after
+* it, so that no 0/1 value has to be computed.
+*
+* @param block - The block holding the instruction
+* @param i - The position of the instruction in the block
+*
+* @return true if the comparison and the branch can be lowered together
+*/
+bool Lowering::isFusedCompare(Block *block, int i) {
+    if(!fuseBranches || i + 2 != block->insts.size()) return false;
+    Inst &compare = block->insts[i], &branch = block->insts[i + 1];
+    return compare.isCompare() && branch.op == OP_CONDBR && branch.args[0] == compare.dst && temps.count(compare.dst);
+}
+
+/**
+* Lowers a comparison together with the conditional branch on it. EQ and NE branch on the
+* operands directly with beq or bne; the others compute slt or sltu into a register and branch
+* on it, GE and LE with the sense of the branch inverted instead of subtracting the
+* result from 1.
+*
+* @param compare - The comparison
+* @param branch - The conditional branch
+* @param next - The block laid out after the current one, or nullptr
+*/
+void Lowering::lowerCompareBranch(Inst &compare, Inst &branch, Block *next) {
+    vector<int> r = fetch(compare.args, {-1, -1});
+    release(compare.args, r);
+    // a temporary register rather than the scratch one, so that it is known to be dead afterwards
+    int t = allocate({});
+    string what = compare.isUnsigned ? "sltu" : "slt";
+    // the branch taken when the comparison is true, and the one taken when it is false
+    string ifTrue = "bne", ifFalse = "beq";
+    vector<string> operands = {reg(t), reg(0)};
+    switch(compare.op) {
+        case OP_EQ:
+            swap(ifTrue, ifFalse);
+            // fall through: an equality branches on the operands like an inequality, the other way
+        case OP_NE:
+            operands = {reg(r[0]), reg(r[1])};
+            break;
+        case OP_LT:
+            emit(what, {reg(t), reg(r[0]), reg(r[1])});
+            break;
+        case OP_GT:
+            emit(what, {reg(t), reg(r[1]), reg(r[0])});
+            break;
+        case OP_GE:
+            emit(what, {reg(t), reg(r[0]), reg(r[1])});
+            swap(ifTrue, ifFalse);
+            break;
+        case OP_LE:
+            emit(what, {reg(t), reg(r[1]), reg(r[0])});
+            swap(ifTrue, ifFalse);
+            break;
+        default:
+            break;
+    }
+    if(branch.blocks[1] == next) {
+        emit(ifTrue, {operands[0], operands[1], label(branch.blocks[0])});
+        return;
+    }
+    emit(ifFalse, {operands[0], operands[1], label(branch.blocks[1])});
+    if(branch.blocks[0] != next) emit("beq", {reg(0), reg(0), label(branch.blocks[0])});
+}
@@ -0,0 +1,146 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "ir.h"
+#include "instruction.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+ * Lowers the IR to stack-machine MIPS.
+ *
+ * Calling convention: the first four arguments are passed in $1, $2, $6 and $7 (wain receives
+ * its two in $1 and $2 from the loader); the caller pushes the others in order and jumps with
+ * jalr. The callee saves the caller's $29 just below $30 and points $29 at that word, so stack
+ * argument k of n is at 4 * (n - k)($29) and the frame follows at -4($29), -8($29), ... A
+ * procedure that makes calls saves $31 in its frame on entry. The result is returned in $3; the
+ * callee restores $29 and $30, and the caller pops the stack arguments.
+ * A call in tail position to a procedure with no more stack arguments than the caller stores
+ * them over the caller's own, pops the frame and jumps, so the callee returns directly to the
+ * caller's caller, which pops the caller's arguments.
+ * Registers $12-$28 hold locals and are callee-saved (see regalloc.h); all others are
+ * caller-saved. A leaf procedure, which calls nothing, keeps up to three locals in caller-saved
+ * registers instead and addresses its frame from $30 without moving it or setting up $29.
+ *
+ * Labels are scoped by procedure ("loop3infact"). Stems contain no digits, so the name after the
+ * number identifies the procedure, and each procedure can be lowered on its own thread.
+ *
+ * A value that is used once, by a later instruction of the same block, is a temporary: it is
+ * computed into a register from a pool of caller-saved registers and stays there until it is
+ * used. Only when the pool runs out, or across a call, is it stored to a spill slot; the frame
+ * has as many spill slots as the function ever needs at once, so $30 does not move for spills.
+ * Every other value gets a home slot in the frame.
+ */
+class Lowering {
+	public:
+		vector<Instruction> lower(Module&);
+		map<string, double> getPassTimes();
+		void setThreads(int);
+		void setRegisterAllocation(bool);
+		void setTailCalls(bool);
+		void setBranchFusion(bool);
+	private:
+		vector<Instruction> program;
+		int threads = 1;
+		bool allocateRegisters = false;
+		bool tailCalls = false;
+		bool fuseBranches = false;
+		Module *module = nullptr;
+		int labelCount = 0;
+		map<Block*, string> labels;
+		// time spent in regalloc, tail-calls and branch-fusion, in milliseconds
+		map<string, double> passTimes;
+
+		// state of the function being lowered
+		Function *function = nullptr;
+		map<int, int> slotOffset;
+		map<int, int> homeOffset;
+		set<int> temps;
+		// slot -> register holding it, for slots allocated to $12-$28
+		map<int, int> slotRegister;
+		// value loaded from a slot -> register it can be read from
+		map<int, int> alias;
+		// callee-saved register -> where the prologue saves it
+		map<int, int> saveOffset;
+		// the function calls procedures or the runtime, so $31 is saved on entry
+		bool makesCalls = false;
+		// registers that hold temporaries in the function being lowered
+		vector<int> temporaries;
+		// register the frame is addressed from: $29, or $30 in a leaf, which does not set up $29
+		int frameRegister = 29;
+		// where $31 is saved
+		int returnOffset = 0;
+		// offset of spill slot 0; slot k is 4 * k bytes below it
+		int spillBase = 0;
+		// number of spill slots the function needs, found by a dry run
+		int spillCount = 0;
+		int frameSize = 0;
+
+		// state of the block being lowered
+		bool dryRun = false;
+		// register -> temporary it holds, -1 if free
+		int owner[32];
+		// register -> value whose home slot it holds a copy of, -1 if none
+		int cached[32];
+		// register -> constant it was loaded with and still holds
+		map<int, int> constants;
+		// temporary -> register, for temporaries in registers
+		map<int, int> location;
+		// temporaries in registers, oldest first
+		vector<int> live;
+		// spilled temporary -> its spill slot
+		map<int, int> spillSlot;
+		map<int, int> uses;
+
+		vector<Instruction> lowerFunction(Function&);
+		void layoutFrame();
+		void useCallerSavedRegisters();
+		void classifyValues();
+		void findAliases();
+		void lowerBlock(Block*, Block*);
+		void lowerInst(Inst&);
+		void lowerCall(Inst&);
+		int registerHolding(int);
+		void loadOperand(int, int);
+		void moveArguments(vector<int>);
+		bool isTailCall(Block*, int);
+		void lowerTailCall(Inst&);
+		void lowerTerminator(Inst&, Block*);
+		bool isFusedCompare(Block*, int);
+		void lowerCompareBranch(Inst&, Inst&, Block*);
+		void copyPhis(Block*, Block*);
+		void splitPhiEdges();
+
+		vector<int> fetch(vector<int>, vector<int>);
+		void release(vector<int>, vector<int>);
+		void define(int, int);
+		int allocate(set<int>);
+		int constantRegister(int);
+		int take(int);
+		void spill(int);
+		void spillExcept(vector<int>);
+		int spillOffset(int);
+		void saveReturnAddress();
+		void restoreReturnAddress();
+		void forgetCaches();
+
+		void generatePrologue();
+		void generateEpilogue();
+		void popFrame();
+		void callRuntime(string);
+		void adjustStack(int);
+		void push(int);
+		void pop(int);
+		void constantGenerator(int, int);
+		void emit(string, vector<string> = {});
+		void emitLabel(string);
+		string getUniqueLabel(string);
+		string label(Block*);
+};
+
+string reg(int);
+
+#endif
@@ -0,0 +1,202 @@
+#include "irpasses.h"
+#include <climits>
+
+// A magic number and shift for signed division by a constant (Hacker's Delight, 10-1).
+struct Magic {
+    int multiplier;
+    int shift;
+};
+
+/**
+* Computes the magic number M and shift s such that x / d == (mulhi(x, M) [+ or - x]) >> s plus
+* one if that is negative, for every 32-bit x (Granlund and Montgomery).
+*
+* @param d - The divisor, with 2 <= |d| and d != INT_MIN
+*
+* @return The magic number and shift
+*/
+static Magic computeMagic(int d) {
+    const unsigned two31 = 0x80000000u;
+    unsigned ad = d < 0 ? -(unsigned)d : d;
+    unsigned t = two31 + ((unsigned)d >> 31);
+    unsigned anc = t - 1 - t % ad;
+    int p = 31;
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned q2 = two31 / ad, r2 = two31 - q2 * ad;
+    unsigned delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if(r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if(r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+    Magic magic;
+    magic.multiplier = q2 + 1;
+    if(d < 0) magic.multiplier = -(unsigned)magic.multiplier;
+    magic.shift = p - 32;
+    return magic;
+}
+
+/**
+* Builds the replacement for a division or remainder by a constant as a straight-line sequence
+* of IR instructions. There are no shifts on the target, so x >> s is the high word of x * 2^(32-s).
+*/
+class DivisionExpander {
+	public:
+		DivisionExpander(Function &function, vector<Inst> &insts) : function{function}, insts{insts} {}
+		int quotient(int, int);
+		int remainder(int, int, int);
+	private:
+		Function &function;
+		vector<Inst> &insts;
+
+		int add(Opcode, int, int);
+		int constant(int);
+		int floorShift(int, int);
+};
+
+/**
+* Appends an instruction with two operands.
+*
+* @param op - The opcode
+* @param a - The first operand
+* @param b - The second operand
+*
+* @return The value it defines
+*/
+int DivisionExpander::add(Opcode op, int a, int b) {
+    Inst inst(op);
+    inst.dst = function.newValue(INT);
+    inst.args = {a, b};
+    insts.push_back(inst);
+    return inst.dst;
+}
+
+/**
+* Appends a constant.
+*
+* @param value - The value of the constant
+*
+* @return The value it defines
+*/
+int DivisionExpander::constant(int value) {
+    Inst inst(OP_CONST);
+    inst.dst = function.newValue(INT);
+    inst.imm = value;
+    insts.push_back(inst);
+    return inst.dst;
+}
+
+/**
+* Divides by 2^s rounding towards minus infinity, i.e. an arithmetic shift right.
+*
+* @param x - The value to shift
+* @param s - The shift, 0 to 30
+*
+* @return The shifted value
+*/
+int DivisionExpander::floorShift(int x, int s) {
+    if(s == 0) return x;
+    // 2^31 does not fit, but x + floor(-x / 2) == floor(x / 2)
+    if(s == 1) return add(OP_ADD, x, add(OP_MULHI, x, constant(INT_MIN)));
+    return add(OP_MULHI, x, constant(1 << (32 - s)));
+}
+
+/**
+* Computes x / d, rounding towards zero like div.
+*
+* @param x - The dividend
+* @param d - The divisor, non-zero
+*
+* @return The value holding the quotient
+*/
+int DivisionExpander::quotient(int x, int d) {
+    if(d == 1) return x;
+    // INT_MIN / -1 == INT_MIN, which is also what 0 - INT_MIN wraps to
+    if(d == -1) return add(OP_SUB, constant(0), x);
+    if(d == INT_MIN) return add(OP_EQ, x, constant(INT_MIN));
+    int negative = add(OP_LT, x, constant(0));
+    int k = exactLog2(d < 0 ? -d : d);
+    if(k > 0) {
+        // negative dividends are biased by 2^k - 1 so that the shift rounds towards zero
+        int bias = k == 1 ? negative : add(OP_MUL, negative, constant((1 << k) - 1));
+        int q = floorShift(add(OP_ADD, x, bias), k);
+        return d < 0 ? add(OP_SUB, constant(0), q) : q;
+    }
+    Magic magic = computeMagic(d);
+    int q = add(OP_MULHI, x, constant(magic.multiplier));
+    if(d > 0 && magic.multiplier < 0) q = add(OP_ADD, q, x);
+    if(d < 0 && magic.multiplier > 0) q = add(OP_SUB, q, x);
+    q = floorShift(q, magic.shift);
+    // add one to negative quotients, rounding them towards zero
+    return add(OP_ADD, q, add(OP_LT, q, constant(0)));
+}
+
+/**
+* Computes x % d, with the sign of x like mfhi after div.
+*
+* @param x - The dividend
+* @param d - The divisor, non-zero
+* @param dst - The value the remainder is assigned to
+*
+* @return The value holding the remainder
+*/
+int DivisionExpander::remainder(int x, int d, int dst) {
+    int product = add(OP_MUL, quotient(x, d), constant(d));
+    Inst inst(OP_SUB);
+    inst.dst = dst;
+    inst.args = {x, product};
+    insts.push_back(inst);
+    return dst;
+}
+
+/**
+* Replaces signed division and remainder by a constant with multiplications by a magic number
+* and corrections, or for powers of two with a biased shift. Divisions by zero and the exact
+* divisions of pointer differences (see reduceStrength) are left alone.
+*
+* @param function - The function to optimize
+*
+* @return true if any division was replaced
+*/
+bool divideByConstants(Function &function) {
+    map<int, int> constants;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CONST) constants[inst.dst] = inst.imm;
+        }
+    }
+    bool changed = false;
+    // quotient -> the value that now holds it
+    vector<pair<int, int>> replaced;
+    for(auto &block: function.blocks) {
+        vector<Inst> insts;
+        DivisionExpander expander(function, insts);
+        for(auto &inst: block->insts) {
+            bool divides = inst.op == OP_DIV || inst.op == OP_REM;
+            if(!divides || inst.isExact || !constants.count(inst.args[1]) || constants[inst.args[1]] == 0) {
+                insts.push_back(inst);
+                continue;
+            }
+            int d = constants[inst.args[1]];
+            if(inst.op == OP_REM) expander.remainder(inst.args[0], d, inst.dst);
+            else replaced.push_back({inst.dst, expander.quotient(inst.args[0], d)});
+            changed = true;
+        }
+        block->insts = insts;
+    }
+    // a later quotient may be an earlier one unchanged (x / 1), so those are replaced first
+    for(int i = replaced.size() - 1; i >= 0; i--) replaceAllUses(function, replaced[i].first, replaced[i].second);
+    if(changed) removeDeadValues(function);
+    return changed;
+}
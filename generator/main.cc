@@ -1,12 +1,103 @@
 #include "wlp4gen.h"
 #include "tree.h"
+#include "passes.h"
+#include "lower.h"
+#include "parallel.h"
+#include "binary.h"
+
+/**
+* Splits a comma separated list of pass names and checks that every pass exists.
+*
+* @param list - The list from -enable-pass= or -disable-pass=
+* @param names - Where the names are stored
+*
+* @return true if every name is a registered pass
+*/
+bool parsePassList(string list, vector<string> &names) {
+    stringstream stream{list};
+    string name;
+    while(getline(stream, name, ',')) {
+        if(!PassManager::passExists(name)) {
+            cerr << "ERROR: unknown pass \"" << name << "\"" << endl;
+            return false;
+        }
+        names.push_back(name);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    PassManager passManager;
+    bool timePasses = false;
+    bool printStatistics = false;
+    bool printRemarks = false;
+    bool dumpIR = false;
+    bool verifyIR = false;
+    bool emitBinary = false;
+    int threads = defaultThreadCount();
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        vector<string> names;
+        if(arg == "-O0" || arg == "-O1" || arg == "-O2") passManager.setOptLevel(arg[2] - '0');
+        else if(arg == "-time-passes") timePasses = true;
+        else if(arg == "-stats") printStatistics = true;
+        else if(arg == "-remarks") printRemarks = true;
+        else if(arg == "-dump-ir") dumpIR = true;
+        else if(arg == "-verify-ir") verifyIR = true;
+        else if(arg == "-emit=asm") emitBinary = false;
+        else if(arg == "-emit=bin") emitBinary = true;
+        else if(arg == "-j" && i + 1 < argc) threads = max(1, atoi(argv[++i]));
+        else if(arg.find("-j") == 0 && arg.size() > 2) threads = max(1, atoi(arg.c_str() + 2));
+        else if(arg == "-print-passes") {
+            PassManager::printPasses(cout);
+            return 0;
+        }
+        else if(arg.find("-enable-pass=") == 0) {
+            if(!parsePassList(arg.substr(13), names)) return 1;
+            for(auto &name: names) passManager.enablePass(name);
+        }
+        else if(arg.find("-disable-pass=") == 0) {
+            if(!parsePassList(arg.substr(14), names)) return 1;
+            for(auto &name: names) passManager.disablePass(name);
+        }
+        else {
+            cerr << "ERROR: unknown option \"" << arg << "\"" << endl;
+            return 1;
+        }
+    }
+    passManager.setTimePasses(timePasses);
+    passManager.setThreads(threads);
 
-int main() {
     Compiler compiler;
+    compiler.setThreads(threads);
     auto tree = make_unique<Tree>();
     tree->root = tree->makeTree();
     // compiler.generatePrologue();
     compiler.compile(tree->root.get());
     // compiler.generateEpilogue();
     compiler.printVariableTable();
+
+    Module &module = compiler.getModule();
+    if(verifyIR) {
+        for(auto &function: module.functions) verifyFunction(*function, cerr);
+    }
+    passManager.run(module);
+    if(verifyIR) {
+        for(auto &function: module.functions) verifyFunction(*function, cerr);
+    }
+    if(dumpIR) dumpModule(module, cerr);
+    if(printRemarks) PassManager::printRemarks(cerr);
+
+    Lowering lowering;
+    lowering.setThreads(threads);
+    vector<Instruction> program = passManager.lower(module, lowering);
+    passManager.run(program);
+    if(emitBinary) {
+        if(!writeObject(program, cout)) return 1;
+    }
+    else {
+        for(auto &instr: program) cout << instr.toString() << endl;
+    }
+    if(timePasses) passManager.printTimings(cerr);
+    if(printStatistics) PassManager::printStatistics(cerr);
 }
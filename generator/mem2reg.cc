@@ -0,0 +1,192 @@
+#include "irpasses.h"
+#include "passes.h"
+#include <algorithm>
+
+/**
+* Turns the slots whose address is never taken into SSA values. Such a slot can only be read
+* and written by SLOAD and SSTORE, never through a pointer, so every load can be replaced by the
+* value last stored on the way to it. Phis are placed at the iterated dominance frontier of the
+* stores, and the blocks are then renamed in dominator tree order, each load reading the value
+* of the innermost store or phi. Parameters start out with the value they arrive with, read by a
+* single load in the entry block; locals are always assigned before they are read.
+*/
+class SlotPromotion {
+	public:
+		SlotPromotion(Function &function) : function{function} {}
+		bool run();
+	private:
+		Function &function;
+		map<Block*, Block*> idom;
+		map<Block*, vector<Block*>> children;
+		// phi -> the slot it merges
+		map<int, int> phiSlot;
+		// slot -> its values along the current dominator tree path, innermost last
+		map<int, vector<int>> current;
+		// removed load -> the value that replaced it
+		map<int, int> replacement;
+		set<int> promoted;
+		// constants standing for slots not assigned yet, to be put in the entry block
+		vector<Inst> undefined;
+
+		void placePhis();
+		int valueOf(int);
+		void rename(Block*);
+};
+
+/**
+* Inserts the phis each promoted slot needs: wherever the values stored on two paths meet, i.e.
+* at the dominance frontier of the blocks storing it, and of those phis in turn.
+*/
+void SlotPromotion::placePhis() {
+    map<Block*, set<Block*>> frontier;
+    for(auto &block: function.blocks) {
+        if(block->preds.size() < 2) continue;
+        for(auto pred: block->preds) {
+            for(Block *runner = pred; runner != idom[block.get()]; runner = idom[runner]) frontier[runner].insert(block.get());
+        }
+    }
+    map<int, set<Block*>> storing;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_SSTORE) storing[inst.imm].insert(block.get());
+        }
+    }
+    for(auto slot: promoted) {
+        vector<Block*> work(storing[slot].begin(), storing[slot].end());
+        set<Block*> placed;
+        while(!work.empty()) {
+            Block *block = work.back();
+            work.pop_back();
+            for(auto target: frontier[block]) {
+                if(!placed.insert(target).second) continue;
+                Inst phi(OP_PHI);
+                phi.dst = function.newValue(function.slots[slot].type);
+                phiSlot[phi.dst] = slot;
+                target->insts.insert(target->insts.begin(), phi);
+                work.push_back(target);
+            }
+        }
+    }
+}
+
+/**
+* Returns the value a slot holds at the current point of the renaming. A slot of a procedure
+* inlined into a loop may not be assigned yet on the path into the loop; it then holds a
+* constant 0 that is never read.
+*
+* @param slot - The slot
+*
+* @return The value
+*/
+int SlotPromotion::valueOf(int slot) {
+    if(current[slot].empty()) {
+        Inst zero(OP_CONST);
+        zero.dst = function.newValue(function.slots[slot].type);
+        zero.imm = 0;
+        undefined.push_back(zero);
+        current[slot].push_back(zero.dst);
+    }
+    return current[slot].back();
+}
+
+/**
+* Renames the loads and stores of the promoted slots in a block, fills in the operands of the
+* phis of its successors, and continues with the blocks it immediately dominates.
+*
+* @param block - The block
+*/
+void SlotPromotion::rename(Block *block) {
+    map<int, int> pushed;
+    vector<Inst> kept;
+    for(auto inst: block->insts) {
+        for(auto &arg: inst.args) {
+            if(replacement.count(arg)) arg = replacement[arg];
+        }
+        if(inst.op == OP_PHI && phiSlot.count(inst.dst)) {
+            current[phiSlot[inst.dst]].push_back(inst.dst);
+            pushed[phiSlot[inst.dst]]++;
+        }
+        else if(inst.op == OP_SLOAD && promoted.count(inst.imm) && !current[inst.imm].empty()) {
+            replacement[inst.dst] = current[inst.imm].back();
+            continue;
+        }
+        else if(inst.op == OP_SLOAD && promoted.count(inst.imm)) {
+            // the value a parameter arrives with
+            current[inst.imm].push_back(inst.dst);
+            pushed[inst.imm]++;
+        }
+        else if(inst.op == OP_SSTORE && promoted.count(inst.imm)) {
+            current[inst.imm].push_back(inst.args[0]);
+            pushed[inst.imm]++;
+            continue;
+        }
+        kept.push_back(inst);
+    }
+    block->insts = kept;
+    set<Block*> done;
+    for(auto succ: block->succs()) {
+        if(!done.insert(succ).second) continue;
+        for(auto &inst: succ->insts) {
+            if(inst.op != OP_PHI) break;
+            if(!phiSlot.count(inst.dst)) continue;
+            inst.args.push_back(valueOf(phiSlot[inst.dst]));
+            inst.blocks.push_back(block);
+        }
+    }
+    for(auto child: children[block]) rename(child);
+    for(auto &slot: pushed) current[slot.first].resize(current[slot.first].size() - slot.second);
+}
+
+/**
+* Promotes every slot whose address is not taken. The entry block first gets a load of each
+* promoted parameter, which stands for the value it arrives with.
+*
+* @return true if the function was changed
+*/
+bool SlotPromotion::run() {
+    set<int> addressTaken = findAddressTakenSlots(function);
+    for(int i = 0; i < function.slots.size(); i++) {
+        if(!addressTaken.count(i)) promoted.insert(i);
+    }
+    if(promoted.empty()) return false;
+    removeUnreachableBlocks(function);
+    idom = computeDominators(function);
+    for(auto &entry: idom) {
+        if(entry.first != entry.second) children[entry.second].push_back(entry.first);
+    }
+    // visit the children in layout order, so that the output does not depend on pointer values
+    map<Block*, int> position;
+    for(int i = 0; i < function.blocks.size(); i++) position[function.blocks[i].get()] = i;
+    for(auto &node: children) {
+        sort(node.second.begin(), node.second.end(), [&](Block *a, Block *b) { return position[a] < position[b]; });
+    }
+    vector<Inst> params;
+    for(auto slot: promoted) {
+        if(function.slots[slot].param < 0) continue;
+        Inst load(OP_SLOAD);
+        load.dst = function.newValue(function.slots[slot].type);
+        load.imm = slot;
+        params.push_back(load);
+    }
+    Block *entry = function.entry();
+    entry->insts.insert(entry->insts.begin(), params.begin(), params.end());
+    placePhis();
+    rename(entry);
+    entry->insts.insert(entry->insts.begin(), undefined.begin(), undefined.end());
+    removeDeadPhis(function);
+    removeDeadValues(function);
+    PassManager::recordStatistic("mem2reg", "slots promoted", promoted.size());
+    return true;
+}
+
+/**
+* Turns locals and parameters whose address is never taken into SSA values.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool promoteSlots(Function &function) {
+    SlotPromotion promotion(function);
+    return promotion.run();
+}
@@ -0,0 +1,38 @@
+#include "parallel.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+* Returns the number of threads to use when none is given on the command line.
+*
+* @return The number of hardware threads, at least 1
+*/
+int defaultThreadCount() {
+    int count = thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+/**
+* Calls body(i) for every i in [0, count) on a pool of threads. Each index is handled exactly
+* once, so callers that write results into slot i of a vector get the same output whatever the
+* scheduling. With one thread everything runs in order on the calling thread.
+*
+* @param count - The number of work items
+* @param threads - The maximum number of threads to use
+* @param body - The work for one item
+*/
+void parallelFor(int count, int threads, const function<void(int)> &body) {
+    if(threads <= 1 || count <= 1) {
+        for(int i = 0; i < count; i++) body(i);
+        return;
+    }
+    atomic<int> next{0};
+    vector<thread> pool;
+    for(int t = 0; t < threads && t < count; t++) {
+        pool.emplace_back([&]() {
+            for(int i = next++; i < count; i = next++) body(i);
+        });
+    }
+    for(auto &worker: pool) worker.join();
+}
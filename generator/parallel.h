@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+using namespace std;
+
+int defaultThreadCount();
+void parallelFor(int, int, const function<void(int)>&);
+
+#endif
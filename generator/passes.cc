@@ -0,0 +1,376 @@
+#include "passes.h"
+#include "irpasses.h"
+#include "parallel.h"
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+
+// pass -> counter -> value, for -stats; IR passes run in parallel, so updates are locked
+static map<string, map<string, int>> statistics;
+// pass: message, in the order they were made, for -remarks
+static vector<string> remarks;
+static mutex statisticsLock;
+
+/**
+* Returns the table of every pass the pass manager knows about, in pipeline order.
+*
+* @return The pass registry
+*/
+const vector<PassInfo>& PassManager::registry() {
+    static const vector<PassInfo> passes = {
+        {"dead-procedures", "drop procedures that cannot be reached from wain through calls", 1, nullptr, nullptr, removeDeadProcedures},
+        {"inline", "substitute small non-recursive procedures at their call sites (cost model, see -remarks)", 2, nullptr, nullptr, inlineProcedures},
+        {"tailrec", "turn calls of a procedure to itself in tail position into loops", 1, eliminateTailRecursion, nullptr, nullptr},
+        {"loop-rotate", "copy the test of a while loop to the end of its body, so each iteration takes one branch", 1, rotateLoops, nullptr, nullptr},
+        {"if-convert", "replace IF statements that assign one of two values to a variable by branch-free code", 1, convertIfs, nullptr, nullptr},
+        {"mem2reg", "turn locals and parameters whose address is not taken into SSA values", 1, promoteSlots, nullptr, nullptr},
+        {"sccp", "fold constant expressions and propagate constants through values, phis and slots", 1, propagateConstants, nullptr, nullptr},
+        {"magic-div", "replace division and remainder by a constant with multiply-high sequences", 2, divideByConstants, nullptr, nullptr},
+        {"gvn", "reuse values already computed by a dominating instruction (global value numbering)", 1, eliminateCommonSubexpressions, nullptr, nullptr},
+        {"load-elim", "reuse the value last loaded from or stored to a location that nothing may have changed since", 1, eliminateRedundantLoads, nullptr, nullptr},
+        {"licm", "hoist computations that do not change inside a loop into a preheader", 1, hoistLoopInvariants, nullptr, nullptr},
+        {"strength-reduce", "turn multiplications by small powers of two into additions, exact divisions into mulhi, fold constant offsets into lw/sw", 1, reduceStrength, nullptr, nullptr},
+        {"simplifycfg", "merge straight-line blocks, forward empty blocks, drop unreachable ones", 1, simplifyCFG, nullptr, nullptr},
+        {"regalloc", "keep locals and parameters in registers $12-$28 (graph coloring)", 1, nullptr, nullptr, nullptr},
+        {"branch-fusion", "lower comparisons that only decide a branch as the branch itself (beq, bne, slt + branch)", 1, nullptr, nullptr, nullptr},
+        {"tail-calls", "jump to procedures called in tail position, reusing the caller's frame", 1, nullptr, nullptr, nullptr},
+        {"jump-thread", "retarget branches whose target is another unconditional branch", 1, nullptr, threadJumps, nullptr},
+        {"unreachable", "delete code that follows an unconditional jump and has no label", 1, nullptr, removeUnreachable, nullptr},
+        {"peephole", "rewrite redundant instruction sequences using a table of rules", 1, nullptr, peephole, nullptr},
+    };
+    return passes;
+}
+
+/**
+* Checks if a pass with the given name is registered.
+*
+* @param name - The name of the pass
+*
+* @return true if the pass exists
+*/
+bool PassManager::passExists(string name) {
+    for(auto &pass: registry()) {
+        if(pass.name == name) return true;
+    }
+    return false;
+}
+
+/**
+* Prints the registered passes with the -O level that enables them.
+*
+* @param out - The stream to print to
+*/
+void PassManager::printPasses(ostream &out) {
+    for(auto &pass: registry()) {
+        string kind = pass.runIR ? "  ir     " : pass.runAsm ? "  asm    " : pass.runModule ? "  module " : "  lower  ";
+        out << left << setw(16) << pass.name << " -O" << pass.level << kind
+            << pass.description << endl;
+    }
+}
+
+PassManager::PassManager() {}
+
+/**
+* Sets the optimization level that selects the default pipeline.
+*
+* @param level - 0, 1 or 2
+*/
+void PassManager::setOptLevel(int level) { optLevel = level; }
+
+/**
+* Adds a pass to the pipeline regardless of the optimization level.
+*
+* @param name - The name of the pass
+*/
+void PassManager::enablePass(string name) {
+    enabled.insert(name);
+    disabled.erase(name);
+}
+
+/**
+* Removes a pass from the pipeline regardless of the optimization level.
+*
+* @param name - The name of the pass
+*/
+void PassManager::disablePass(string name) {
+    disabled.insert(name);
+    enabled.erase(name);
+}
+
+/**
+* Turns the per-pass timing report on or off.
+*
+* @param on - true to record timings
+*/
+void PassManager::setTimePasses(bool on) { timePasses = on; }
+
+/**
+* Sets how many functions an IR pass processes at the same time.
+*
+* @param count - The number of threads
+*/
+void PassManager::setThreads(int count) { threads = count; }
+
+/**
+* Returns the names of the passes that will run, in order.
+*
+* @return The pipeline for the current level and enabled/disabled passes
+*/
+vector<string> PassManager::pipeline() {
+    vector<string> names;
+    for(auto &pass: registry()) {
+        if(disabled.count(pass.name)) continue;
+        if(pass.level <= optLevel || enabled.count(pass.name)) names.push_back(pass.name);
+    }
+    return names;
+}
+
+/**
+* Checks if a pass is part of the pipeline. The lowering uses this for the passes it implements.
+*
+* @param name - The name of the pass
+*
+* @return true if the pass will run
+*/
+bool PassManager::isEnabled(string name) {
+    for(auto &pass: pipeline()) {
+        if(pass == name) return true;
+    }
+    return false;
+}
+
+/**
+* Finds a pass in the registry.
+*
+* @param name - The name of the pass
+*
+* @return The pass, or nullptr if there is none with that name
+*/
+const PassInfo *PassManager::findPass(string name) {
+    for(auto &info: registry()) {
+        if(info.name == name) return &info;
+    }
+    return nullptr;
+}
+
+/**
+* Runs the IR and module passes of the pipeline over a module. Functions are independent, so each
+* IR pass runs on all of them in parallel. When timing is on, the wall time and the number of IR
+* instructions before and after are recorded for every pass.
+*
+* @param module - The module to optimize
+*/
+void PassManager::run(Module &module) {
+    for(auto &name: pipeline()) {
+        const PassInfo *pass = findPass(name);
+        if(!pass->runIR && !pass->runModule) continue;
+        int before = module.countInsts();
+        auto start = chrono::steady_clock::now();
+        if(pass->runModule) pass->runModule(module);
+        else parallelFor(module.functions.size(), threads, [&](int i) { pass->runIR(*module.functions[i]); });
+        auto end = chrono::steady_clock::now();
+        double ms = chrono::duration<double, milli>(end - start).count();
+        if(timePasses) timings.push_back({name + (pass->runModule ? " (module)" : " (ir)"), ms, before, module.countInsts(), TIMING_IR});
+    }
+}
+
+/**
+* Runs the asm passes of the pipeline over a program. When timing is on, the wall time and the
+* number of instructions before and after are recorded for every pass.
+*
+* @param program - The program to optimize
+*/
+void PassManager::run(vector<Instruction> &program) {
+    for(auto &name: pipeline()) {
+        const PassInfo *pass = findPass(name);
+        if(!pass->runAsm) continue;
+        if(!timePasses) {
+            pass->runAsm(program);
+            continue;
+        }
+        int before = countInstructions(program);
+        auto start = chrono::steady_clock::now();
+        pass->runAsm(program);
+        auto end = chrono::steady_clock::now();
+        double ms = chrono::duration<double, milli>(end - start).count();
+        timings.push_back({name, ms, before, countInstructions(program), TIMING_ASM});
+    }
+}
+
+/**
+* Lowers a module to MIPS with the passes of the pipeline that the lowering implements turned on.
+* When timing is on, the lowering is recorded with the number of IR instructions before and of
+* MIPS instructions after, followed by the time spent in each of those passes, summed over the
+* threads.
+*
+* @param module - The module to lower
+* @param lowering - The lowering to use
+*
+* @return The generated program
+*/
+vector<Instruction> PassManager::lower(Module &module, Lowering &lowering) {
+    lowering.setRegisterAllocation(isEnabled("regalloc"));
+    lowering.setTailCalls(isEnabled("tail-calls"));
+    lowering.setBranchFusion(isEnabled("branch-fusion"));
+    int before = module.countInsts();
+    auto start = chrono::steady_clock::now();
+    vector<Instruction> program = lowering.lower(module);
+    auto end = chrono::steady_clock::now();
+    if(!timePasses) return program;
+    double ms = chrono::duration<double, milli>(end - start).count();
+    timings.push_back({"lower", ms, before, countInstructions(program), TIMING_LOWERING});
+    map<string, double> passTimes = lowering.getPassTimes();
+    for(auto &name: pipeline()) {
+        if(passTimes.count(name)) timings.push_back({name + " (in lower)", passTimes[name], 0, 0, TIMING_IN_LOWERING});
+    }
+    return program;
+}
+
+/**
+* Prints the timing report collected by run and lower. The IR passes and the asm passes count
+* different instructions, so each kind gets a total of its own; the passes done by the lowering
+* are part of its time and are not added to the total again.
+*
+* @param out - The stream to print to
+*/
+void PassManager::printTimings(ostream &out) {
+    double total = 0;
+    // IR and MIPS instruction counts before the first and after the last pass of each kind
+    map<TimingKind, pair<int, int>> counts;
+    map<TimingKind, double> times;
+    out << "===--- Pass execution timing report (-O" << optLevel << ") ---===" << endl;
+    out << right << setw(12) << "Wall (ms)" << setw(10) << "Before" << setw(10) << "After"
+        << setw(8) << "Delta" << "  Pass" << endl;
+    for(auto &t: timings) {
+        out << right << setw(12) << fixed << setprecision(3) << t.milliseconds;
+        if(t.kind == TIMING_IN_LOWERING) out << setw(10) << "" << setw(10) << "" << setw(8) << "";
+        else if(t.kind == TIMING_LOWERING) out << setw(10) << t.before << setw(10) << t.after << setw(8) << "";
+        else out << setw(10) << t.before << setw(10) << t.after << setw(8) << (t.after - t.before);
+        out << "  " << t.name << endl;
+        if(t.kind == TIMING_IN_LOWERING) continue;
+        total += t.milliseconds;
+        times[t.kind] += t.milliseconds;
+        if(!counts.count(t.kind)) counts[t.kind].first = t.before;
+        counts[t.kind].second = t.after;
+    }
+    for(auto kind: {TIMING_IR, TIMING_ASM}) {
+        if(!counts.count(kind)) continue;
+        int before = counts[kind].first, after = counts[kind].second;
+        out << right << setw(12) << fixed << setprecision(3) << times[kind] << setw(10) << before
+            << setw(10) << after << setw(8) << (after - before) << "  Total " << (kind == TIMING_IR ? "IR" : "asm") << " passes" << endl;
+    }
+    out << right << setw(12) << fixed << setprecision(3) << total << setw(28) << "" << "  Total" << endl;
+}
+
+/**
+* Adds to a counter kept by a pass, e.g. how often a rewrite rule fired.
+*
+* @param pass - The name of the pass
+* @param counter - The name of the counter
+* @param amount - The amount to add
+*/
+void PassManager::recordStatistic(string pass, string counter, int amount) {
+    lock_guard<mutex> guard(statisticsLock);
+    statistics[pass][counter] += amount;
+}
+
+/**
+* Prints every non-zero counter recorded by the passes.
+*
+* @param out - The stream to print to
+*/
+void PassManager::printStatistics(ostream &out) {
+    lock_guard<mutex> guard(statisticsLock);
+    out << "===--- Statistics collected ---===" << endl;
+    for(auto &pass: statistics) {
+        for(auto &counter: pass.second) {
+            if(counter.second == 0) continue;
+            out << right << setw(8) << counter.second << " " << pass.first << " - " << counter.first << endl;
+        }
+    }
+}
+
+/**
+* Records a message from a pass about a decision it made, e.g. which procedures it removed.
+*
+* @param pass - The name of the pass
+* @param message - The message
+*/
+void PassManager::remark(string pass, string message) {
+    lock_guard<mutex> guard(statisticsLock);
+    remarks.push_back(pass + ": " + message);
+}
+
+/**
+* Prints the remarks made by the passes, in the order they were made.
+*
+* @param out - The stream to print to
+*/
+void PassManager::printRemarks(ostream &out) {
+    lock_guard<mutex> guard(statisticsLock);
+    for(auto &message: remarks) out << "remark: " << message << endl;
+}
+
+/**
+* Removes code that can never run: everything between an unconditional jump and the next label.
+*
+* @param program - The program to optimize
+*
+* @return true if any instruction was removed
+*/
+bool removeUnreachable(vector<Instruction> &program) {
+    vector<Instruction> result;
+    bool reachable = true;
+    bool changed = false;
+    for(auto &instr: program) {
+        if(instr.isLabel()) reachable = true;
+        if(!reachable && instr.isCode()) {
+            changed = true;
+            continue;
+        }
+        result.push_back(instr);
+        if(instr.isUnconditionalJump()) reachable = false;
+    }
+    program = result;
+    return changed;
+}
+
+/**
+* Retargets branches that jump to an unconditional branch so they go straight to its target.
+* This turns the "beq $0, $0, endif1" chains produced by nested if/while into single jumps.
+*
+* @param program - The program to optimize
+*
+* @return true if any branch was retargeted
+*/
+bool threadJumps(vector<Instruction> &program) {
+    // label -> target of the unconditional branch that immediately follows it
+    map<string, string> forward;
+    vector<string> pending;
+    for(auto &instr: program) {
+        if(instr.isLabel()) {
+            pending.push_back(instr.label);
+            continue;
+        }
+        if(!instr.isCode()) continue;
+        if(instr.isUnconditionalJump() && instr.isBranch()) {
+            for(auto &label: pending) forward[label] = instr.branchTarget();
+        }
+        pending.clear();
+    }
+
+    bool changed = false;
+    for(auto &instr: program) {
+        if(!instr.isBranch()) continue;
+        string target = instr.branchTarget();
+        set<string> seen;
+        while(forward.count(target) && !seen.count(target)) {
+            seen.insert(target);
+            target = forward[target];
+        }
+        if(target == instr.branchTarget()) continue;
+        instr = Instruction(instr.op, {instr.args[0], instr.args[1], target});
+        changed = true;
+    }
+    return changed;
+}
@@ -0,0 +1,84 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "instruction.h"
+#include "ir.h"
+#include "lower.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+// A pass rewrites its input in place and returns true if it changed anything. IR passes run on
+// every function before lowering, module passes on the whole module (e.g. to delete or combine
+// functions) and asm passes on the lowered program.
+typedef bool (*IRPass)(Function&);
+typedef bool (*AsmPass)(vector<Instruction>&);
+typedef bool (*ModulePass)(Module&);
+
+struct PassInfo {
+    string name;
+    string description;
+    // lowest -O level whose pipeline runs this pass
+    int level;
+    // at most one of these is set; when none is, the pass is an option of the lowering
+    IRPass runIR;
+    AsmPass runAsm;
+    ModulePass runModule;
+};
+
+// Instruction counts are of IR instructions for IR and module passes, of MIPS instructions for
+// asm passes; the lowering turns the one into the other, and the passes it implements are timed
+// inside it, with no counts of their own.
+enum TimingKind {
+    TIMING_IR, TIMING_ASM, TIMING_LOWERING, TIMING_IN_LOWERING,
+};
+
+struct PassTiming {
+    string name;
+    double milliseconds;
+    int before;
+    int after;
+    TimingKind kind;
+};
+
+class PassManager {
+	public:
+		PassManager();
+		void setOptLevel(int);
+		void enablePass(string);
+		void disablePass(string);
+		void setTimePasses(bool);
+		void setThreads(int);
+		vector<string> pipeline();
+		bool isEnabled(string);
+		void run(Module&);
+		void run(vector<Instruction>&);
+		vector<Instruction> lower(Module&, Lowering&);
+		void printTimings(ostream&);
+
+		static const vector<PassInfo>& registry();
+		static void recordStatistic(string, string, int);
+		static void printStatistics(ostream&);
+		static void remark(string, string);
+		static void printRemarks(ostream&);
+		static bool passExists(string);
+		static void printPasses(ostream&);
+	private:
+		int optLevel = 0;
+		bool timePasses = false;
+		int threads = 1;
+		set<string> enabled;
+		set<string> disabled;
+		vector<PassTiming> timings;
+
+		const PassInfo *findPass(string);
+};
+
+bool removeUnreachable(vector<Instruction>&);
+bool threadJumps(vector<Instruction>&);
+bool peephole(vector<Instruction>&);
+
+#endif
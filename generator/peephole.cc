@@ -0,0 +1,322 @@
+#include "passes.h"
+#include <algorithm>
+
+// how far ahead a register is followed to see if its value is still needed
+static const int DEAD_SCAN_LIMIT = 64;
+// how many instructions may separate two identical lis for the second to be dropped
+static const int LIS_WINDOW = 8;
+
+/**
+* Returns the number of a register operand.
+*
+* @param operand - The operand, e.g. "$3"
+*
+* @return The register number, or -1 if the operand is not a register
+*/
+static int regNumber(const string &operand) {
+    if(operand.size() < 2 || operand[0] != '$') return -1;
+    return stoi(operand.substr(1));
+}
+
+/**
+* Checks if a list of registers contains one.
+*
+* @param regs - The registers
+* @param r - The register to look for
+*
+* @return true if r is in the list
+*/
+static bool contains(const vector<int> &regs, int r) { return find(regs.begin(), regs.end(), r) != regs.end(); }
+
+/**
+* Returns the registers an instruction reads. A jalr reads its target and the argument registers
+* $1, $2, $6 and $7, as does a jr other than the return through $31, which is a tail call.
+*
+* @param instr - The instruction
+* @param known - Set to false if the instruction is not one the peephole pass understands
+*
+* @return The registers read
+*/
+static vector<int> registersRead(const Instruction &instr, bool &known) {
+    const string &op = instr.op;
+    known = true;
+    vector<int> regs;
+    if(op == "add" || op == "sub" || op == "slt" || op == "sltu") regs = {regNumber(instr.args[1]), regNumber(instr.args[2])};
+    else if(op == "mult" || op == "multu" || op == "div" || op == "divu") regs = {regNumber(instr.args[0]), regNumber(instr.args[1])};
+    else if(op == "beq" || op == "bne") regs = {regNumber(instr.args[0]), regNumber(instr.args[1])};
+    else if(op == "lw") regs = {regNumber(instr.args[2])};
+    else if(op == "sw") regs = {regNumber(instr.args[0]), regNumber(instr.args[2])};
+    else if(op == "jr" && instr.args[0] == "$31") regs = {31};
+    else if(op == "jr" || op == "jalr") regs = {regNumber(instr.args[0]), 1, 2, 6, 7};
+    else if(op != "lis" && op != "mfhi" && op != "mflo" && op != ".word") known = false;
+    return regs;
+}
+
+/**
+* Returns the registers an instruction writes. The generated code never expects $1-$9 to survive
+* a call (the lowering spills its temporaries first), so a jalr counts as writing all of them.
+*
+* @param instr - The instruction
+*
+* @return The registers written
+*/
+static vector<int> registersWritten(const Instruction &instr) {
+    const string &op = instr.op;
+    if(op == "add" || op == "sub" || op == "slt" || op == "sltu" || op == "lw" || op == "lis" || op == "mfhi" || op == "mflo") {
+        return {regNumber(instr.args[0])};
+    }
+    if(op == "jalr") return {1, 2, 3, 5, 6, 7, 8, 9, 31};
+    return {};
+}
+
+/**
+* Checks if an instruction only computes its destination register, so that it can be deleted or
+* retargeted when the value is not needed where it is.
+*
+* @param instr - The instruction
+*
+* @return true for add, sub, slt, sltu, lw, lis, mfhi and mflo writing one of $1-$28
+*/
+static bool isPureDefinition(const Instruction &instr) {
+    vector<int> written = registersWritten(instr);
+    if(instr.op == "jalr" || written.size() != 1) return false;
+    int r = written[0];
+    return r >= 1 && r <= 28 && r != 4 && r != 10 && r != 11;
+}
+
+/**
+* Checks if the value of a register is overwritten before it is read on every path from a point
+* of the program. Only straight-line code is followed: labels and branches count as a use,
+* except that the caller-saved registers other than the result $3 are dead at a return.
+*
+* @param program - The program
+* @param start - The first line to look at
+* @param r - The register
+*
+* @return true if the value in the register at that point is never used
+*/
+static bool isDeadAfter(const vector<Instruction> &program, int start, int r) {
+    for(int j = start; j < program.size() && j < start + DEAD_SCAN_LIMIT; j++) {
+        const Instruction &instr = program[j];
+        if(instr.isLabel()) return false;
+        if(!instr.isCode() || instr.op == ".word") continue;
+        bool known;
+        vector<int> read = registersRead(instr, known);
+        if(!known || contains(read, r)) return false;
+        if(contains(registersWritten(instr), r)) return true;
+        if(instr.op == "jr") return r == 1 || r == 2 || (r >= 5 && r <= 9);
+        if(instr.op == "beq" || instr.op == "bne") return false;
+    }
+    return false;
+}
+
+/**
+* Returns the index of the next line at or after a position that is code or a label, skipping
+* directives such as .import.
+*
+* @param program - The program
+* @param i - The position to start at
+*
+* @return The index of the line, or program.size() if there is none
+*/
+static int nextCode(const vector<Instruction> &program, int i) {
+    while(i < program.size() && !program[i].isCode() && !program[i].isLabel()) i++;
+    return i;
+}
+
+/**
+* Checks if a line is "op args...".
+*
+* @param program - The program
+* @param i - The index of the line
+* @param op - The expected mnemonic
+* @param args - The expected operands, "" matches any operand
+*
+* @return true if the line matches
+*/
+static bool matches(const vector<Instruction> &program, int i, string op, vector<string> args) {
+    if(i >= program.size() || program[i].op != op || program[i].args.size() != args.size()) return false;
+    for(int k = 0; k < args.size(); k++) {
+        if(args[k] != "" && program[i].args[k] != args[k]) return false;
+    }
+    return true;
+}
+
+/**
+* Returns the number of lines a definition spans: two for lis and its .word, one otherwise.
+*
+* @param instr - The definition
+*
+* @return The number of lines
+*/
+static int definitionLength(const Instruction &instr) { return instr.op == "lis" ? 2 : 1; }
+
+// sw A, -4($30); sub $30, $30, $4; add $30, $30, $4; lw B, -4($30)  =>  add B, A, $0
+static int pushPop(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    if(!matches(program, i, "sw", {"", "-4", "$30"}) || !matches(program, i + 1, "sub", {"$30", "$30", "$4"})) return 0;
+    if(!matches(program, i + 2, "add", {"$30", "$30", "$4"}) || !matches(program, i + 3, "lw", {"", "-4", "$30"})) return 0;
+    out = {Instruction("add", {program[i + 3].args[0], program[i].args[0], "$0"})};
+    return 4;
+}
+
+// sub $30, $30, $4; add $30, $30, $4  (or the other way round)  =>  nothing
+static int stackAdjust(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    bool down = matches(program, i, "sub", {"$30", "$30", "$4"}) && matches(program, i + 1, "add", {"$30", "$30", "$4"});
+    bool up = matches(program, i, "add", {"$30", "$30", "$4"}) && matches(program, i + 1, "sub", {"$30", "$30", "$4"});
+    out.clear();
+    return down || up ? 2 : 0;
+}
+
+// sw A, K(B); lw C, K(B)  =>  sw A, K(B); add C, A, $0
+static int storeLoad(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    if(!matches(program, i, "sw", {"", "", ""})) return 0;
+    const Instruction &sw = program[i];
+    if(!matches(program, i + 1, "lw", {"", sw.args[1], sw.args[2]})) return 0;
+    out = {sw};
+    if(program[i + 1].args[0] != sw.args[0]) out.push_back(Instruction("add", {program[i + 1].args[0], sw.args[0], "$0"}));
+    return 2;
+}
+
+// lw A, K(B); sw A, K(B)  =>  lw A, K(B)   (A != B)
+static int loadStore(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    if(!matches(program, i, "lw", {"", "", ""})) return 0;
+    const Instruction &lw = program[i];
+    if(lw.args[0] == lw.args[2] || !matches(program, i + 1, "sw", lw.args)) return 0;
+    out = {lw};
+    return 2;
+}
+
+// add A, A, $0  =>  nothing
+static int selfCopy(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    if(!matches(program, i, "add", {"", "", ""})) return 0;
+    const vector<string> &args = program[i].args;
+    bool copy = (args[1] == args[0] && args[2] == "$0") || (args[1] == "$0" && args[2] == args[0]);
+    out.clear();
+    return copy ? 1 : 0;
+}
+
+// beq/bne X, Y, L; L:  =>  L:
+static int branchToNext(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    if(!program[i].isBranch()) return 0;
+    for(int j = i + 1; j < program.size() && program[j].isLabel(); j++) {
+        if(program[j].label != program[i].branchTarget()) continue;
+        out.clear();
+        return 1;
+    }
+    return 0;
+}
+
+// lis A; .word X; ...; lis A; .word X  =>  lis A; .word X; ...  when nothing in between writes A
+static int redundantLis(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    if(!matches(program, i, "lis", {""}) || !matches(program, i + 1, ".word", {""})) return 0;
+    int r = regNumber(program[i].args[0]);
+    for(int j = i + 2; j < program.size() && j < i + 2 + LIS_WINDOW; j++) {
+        const Instruction &instr = program[j];
+        if(instr.isLabel() || instr.op == "jalr" || instr.isUnconditionalJump()) return 0;
+        if(instr.op == "lis" && matches(program, j + 1, ".word", program[i + 1].args) && instr.args == program[i].args) {
+            out.assign(program.begin() + i, program.begin() + j);
+            return j + 2 - i;
+        }
+        if(contains(registersWritten(instr), r)) return 0;
+    }
+    return 0;
+}
+
+// X writes A; add B, A, $0  =>  X writes B   when A is not needed afterwards
+static int forwardCopy(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    const Instruction &def = program[i];
+    if(!def.isCode() || !isPureDefinition(def)) return 0;
+    int copy = i + definitionLength(def);
+    if(!matches(program, copy, "add", {"", "", ""})) return 0;
+    string a = def.args[0];
+    const vector<string> &args = program[copy].args;
+    bool copies = (args[1] == a && args[2] == "$0") || (args[1] == "$0" && args[2] == a);
+    if(!copies || args[0] == a || args[0] == "$0" || !isDeadAfter(program, copy + 1, regNumber(a))) return 0;
+    Instruction retargeted(def.op, def.args);
+    retargeted.args[0] = args[0];
+    out = {retargeted};
+    if(def.op == "lis") out.push_back(program[i + 1]);
+    return copy + 1 - i;
+}
+
+// X writes A  =>  nothing   when A is overwritten before it is read
+static int deadDefinition(const vector<Instruction> &program, int i, vector<Instruction> &out) {
+    const Instruction &def = program[i];
+    if(!def.isCode() || !isPureDefinition(def)) return 0;
+    int length = definitionLength(def);
+    if(!isDeadAfter(program, i + length, regNumber(def.args[0]))) return 0;
+    out.clear();
+    return length;
+}
+
+// A rewrite rule: if the lines starting at a position match, returns how many of them to replace
+// with out; returns 0 otherwise.
+typedef int (*PeepholeMatcher)(const vector<Instruction>&, int, vector<Instruction>&);
+
+struct PeepholeRule {
+    string name;
+    PeepholeMatcher apply;
+};
+
+/**
+* Returns the rules of the peephole pass, tried in order at every position.
+*
+* @return The rule table
+*/
+static const vector<PeepholeRule>& peepholeRules() {
+    static const vector<PeepholeRule> rules = {
+        {"push-pop", pushPop},
+        {"stack-adjust", stackAdjust},
+        {"store-load", storeLoad},
+        {"load-store", loadStore},
+        {"self-copy", selfCopy},
+        {"branch-to-next", branchToNext},
+        {"redundant-lis", redundantLis},
+        {"forward-copy", forwardCopy},
+        {"dead-definition", deadDefinition},
+    };
+    return rules;
+}
+
+/**
+* Slides a window over the program and rewrites every sequence that matches a rule of the table,
+* until no rule matches anywhere. After a rewrite the window backs up a few lines so that
+* sequences the rewrite created are seen. No rule makes code longer, so rewrites are done in
+* place, padded with empty lines that are dropped before the next sweep. The number of hits of
+* every rule is recorded as a statistic (-stats).
+*
+* @param program - The program to optimize
+*
+* @return true if anything was rewritten
+*/
+bool peephole(vector<Instruction> &program) {
+    const vector<PeepholeRule> &rules = peepholeRules();
+    vector<int> hits(rules.size(), 0);
+    bool changed = false;
+    bool progress = true;
+    while(progress) {
+        progress = false;
+        for(int i = nextCode(program, 0); i < program.size(); i = nextCode(program, i + 1)) {
+            for(int k = 0; k < rules.size(); k++) {
+                vector<Instruction> out;
+                int length = rules[k].apply(program, i, out);
+                if(length == 0) continue;
+                for(int j = 0; j < length; j++) program[i + j] = j < out.size() ? out[j] : Instruction();
+                hits[k]++;
+                progress = true;
+                i = max(-1, i - 4);
+                break;
+            }
+        }
+        vector<Instruction> kept;
+        for(auto &instr: program) {
+            if(instr.isLabel() || instr.op != "" || instr.text != "") kept.push_back(instr);
+        }
+        program = kept;
+        changed |= progress;
+    }
+    for(int k = 0; k < rules.size(); k++) {
+        PassManager::recordStatistic("peephole", rules[k].name, hits[k]);
+    }
+    return changed;
+}
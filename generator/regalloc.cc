@@ -0,0 +1,387 @@
+#include "regalloc.h"
+#include "irpasses.h"
+#include <algorithm>
+#include <set>
+
+/**
+* Computes the slots that are live at the start of every block. A slot is live if its current
+* value may still be read by an SLOAD.
+*
+* @param function - The function to analyze
+* @param candidates - The slots to track
+*
+* @return The live-in set of every block
+*/
+static map<Block*, set<int>> computeLiveIn(Function &function, const set<int> &candidates) {
+    map<Block*, set<int>> gen, kill, liveIn;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(!candidates.count(inst.imm)) continue;
+            if(inst.op == OP_SLOAD && !kill[block.get()].count(inst.imm)) gen[block.get()].insert(inst.imm);
+            if(inst.op == OP_SSTORE) kill[block.get()].insert(inst.imm);
+        }
+    }
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(int b = function.blocks.size() - 1; b >= 0; b--) {
+            Block *block = function.blocks[b].get();
+            set<int> live = gen[block];
+            for(auto succ: block->succs()) {
+                for(auto slot: liveIn[succ]) {
+                    if(!kill[block].count(slot)) live.insert(slot);
+                }
+            }
+            if(live != liveIn[block]) {
+                liveIn[block] = live;
+                changed = true;
+            }
+        }
+    }
+    return liveIn;
+}
+
+/**
+* Turns the values that live across blocks back into slots, so that they can be given registers
+* like locals instead of being kept in memory by the lowering.
+*
+* Each phi gets a slot that its predecessors store their operand to before branching, and that the
+* phi's block loads at its top. The phis are copied in parallel, so a predecessor stores a slot
+* only once no other copy still reads it, breaking cycles by loading one slot ahead. Constant
+* operands, often the initial values of variables, are loaded again right before their store
+* instead of being kept in a register until then. No store to such a slot can run between
+* the top of its block and a use of the phi, so every use just loads the slot again, right where
+* it is needed; the same goes for the loads of slots that are never stored, such as the
+* parameters promoted by mem2reg. Any other value used outside the block defining it is stored to
+* a new slot right after it is computed, and each of its uses loads that slot. The constants held
+* in pinned registers are left alone.
+*
+* @param function - The function to rewrite; its critical edges into phis must be split
+*/
+void demoteValues(Function &function) {
+    set<int> addressTaken = findAddressTakenSlots(function), stored;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_SSTORE) stored.insert(inst.imm);
+        }
+    }
+    auto newSlot = [&](int value) {
+        function.slots.push_back({"%" + to_string(value), function.valueTypes[value], -1});
+        return (int)function.slots.size() - 1;
+    };
+    auto load = [&](int slot) {
+        Inst inst(OP_SLOAD);
+        inst.dst = function.newValue(function.slots[slot].type);
+        inst.imm = slot;
+        return inst;
+    };
+
+    map<int, int> phiSlot, constants;
+    set<int> copyLoads;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_PHI) phiSlot[inst.dst] = newSlot(inst.dst);
+            if(inst.op == OP_CONST && !PINNED.count(inst.imm)) constants[inst.dst] = inst.imm;
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto pred: block->preds) {
+            // slot -> value stored to it on this edge
+            vector<pair<int, int>> moves;
+            for(auto &inst: block->insts) {
+                if(inst.op != OP_PHI) break;
+                for(int i = 0; i < inst.blocks.size(); i++) {
+                    int value = inst.args[i];
+                    if(inst.blocks[i] != pred || (phiSlot.count(value) && phiSlot[value] == phiSlot[inst.dst])) continue;
+                    moves.push_back({phiSlot[inst.dst], value});
+                }
+            }
+            vector<Inst> copies;
+            auto fetch = [&](int &value) {
+                if(phiSlot.count(value)) copies.push_back(load(phiSlot[value]));
+                else if(constants.count(value)) {
+                    Inst constant(OP_CONST);
+                    constant.dst = function.newValue(function.valueTypes[value]);
+                    constant.imm = constants[value];
+                    copies.push_back(constant);
+                }
+                else return;
+                value = copies.back().dst;
+                copyLoads.insert(value);
+            };
+            while(!moves.empty()) {
+                // a slot can be stored once no other move still has to read it
+                int ready = -1;
+                for(int k = 0; k < moves.size() && ready < 0; k++) {
+                    ready = k;
+                    for(auto &other: moves) {
+                        if(phiSlot.count(other.second) && phiSlot[other.second] == moves[k].first) ready = -1;
+                    }
+                }
+                if(ready < 0) {
+                    // a cycle: read one of its slots before it is overwritten
+                    for(auto &move: moves) {
+                        if(!phiSlot.count(move.second)) continue;
+                        fetch(move.second);
+                        break;
+                    }
+                    continue;
+                }
+                fetch(moves[ready].second);
+                Inst store(OP_SSTORE);
+                store.args = {moves[ready].second};
+                store.imm = moves[ready].first;
+                copies.push_back(store);
+                moves.erase(moves.begin() + ready);
+            }
+            pred->insts.insert(pred->insts.end() - 1, copies.begin(), copies.end());
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op != OP_PHI) break;
+            int slot = phiSlot[inst.dst];
+            inst.op = OP_SLOAD;
+            inst.args.clear();
+            inst.blocks.clear();
+            inst.imm = slot;
+            stored.erase(slot);
+        }
+    }
+
+    map<int, Block*> defBlock;
+    map<int, int> reload;
+    set<int> demoted;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.dst >= 0) defBlock[inst.dst] = block.get();
+            if(inst.op != OP_SLOAD || addressTaken.count(inst.imm) || stored.count(inst.imm) || copyLoads.count(inst.dst)) continue;
+            reload[inst.dst] = inst.imm;
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            for(auto arg: inst.args) {
+                if(defBlock[arg] != block.get() && !reload.count(arg)) demoted.insert(arg);
+            }
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CONST && PINNED.count(inst.imm)) demoted.erase(inst.dst);
+        }
+    }
+    map<int, int> valueSlot;
+    for(auto value: demoted) valueSlot[value] = newSlot(value);
+    for(auto &block: function.blocks) {
+        vector<Inst> insts;
+        for(auto inst: block->insts) {
+            map<int, int> loaded;
+            for(auto &arg: inst.args) {
+                if(!valueSlot.count(arg) && !reload.count(arg)) continue;
+                if(!loaded.count(arg)) {
+                    insts.push_back(load(reload.count(arg) ? reload[arg] : valueSlot[arg]));
+                    loaded[arg] = insts.back().dst;
+                }
+                arg = loaded[arg];
+            }
+            if(reload.count(inst.dst)) continue;
+            insts.push_back(inst);
+            if(!valueSlot.count(inst.dst)) continue;
+            Inst store(OP_SSTORE);
+            store.args = {inst.dst};
+            store.imm = valueSlot[inst.dst];
+            insts.push_back(store);
+        }
+        block->insts = insts;
+    }
+}
+
+/**
+* Assigns registers to the slots of a function whose address is not taken.
+*
+* Two slots interfere if one is written while the other is live. The interference graph is
+* colored by simplification: nodes with fewer neighbours than there are registers are removed
+* first; when none is left, the node with the lowest spill cost per neighbour is removed and
+* optimistically colored later. Spill costs count the loads and stores of a slot, weighted by
+* 10 to the power of the loop depth. Slots copied to one another that do not interfere are first
+* merged into one node, and the function is rewritten to use a single slot for them, so that the
+* copy disappears whether or not the slot gets a register.
+*
+* @param function - The function to allocate
+*
+* @return The register of every slot that got one
+*/
+map<int, int> allocateSlotRegisters(Function &function) {
+    // slots that are never accessed, e.g. those mem2reg made values of, need no register
+    set<int> candidates, addressTaken = findAddressTakenSlots(function);
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if((inst.op == OP_SLOAD || inst.op == OP_SSTORE) && !addressTaken.count(inst.imm)) candidates.insert(inst.imm);
+        }
+    }
+
+    map<Block*, set<int>> liveIn = computeLiveIn(function, candidates);
+    map<Block*, int> depth = computeLoopDepth(function);
+    map<int, set<int>> interference;
+    map<int, double> cost;
+    for(auto slot: candidates) interference[slot];
+    auto interfere = [&](int a, int b) {
+        if(a == b) return;
+        interference[a].insert(b);
+        interference[b].insert(a);
+    };
+    // a store of a value just loaded from another slot copies that slot; the two hold the same
+    // value afterwards, so they do not interfere there and are coalesced when possible
+    map<pair<int, int>, double> copies;
+    for(auto &block: function.blocks) {
+        double weight = 1;
+        for(int i = 0; i < depth[block.get()] && i < 6; i++) weight *= 10;
+        map<int, int> loadedFrom;
+        vector<int> source(block->insts.size(), -1);
+        for(int i = 0; i < block->insts.size(); i++) {
+            Inst &inst = block->insts[i];
+            if(inst.op == OP_SLOAD) loadedFrom[inst.dst] = inst.imm;
+            if(inst.op != OP_SSTORE) continue;
+            if(loadedFrom.count(inst.args[0]) && candidates.count(loadedFrom[inst.args[0]]) && candidates.count(inst.imm)) {
+                source[i] = loadedFrom[inst.args[0]];
+                copies[{min(source[i], inst.imm), max(source[i], inst.imm)}] += weight;
+            }
+            for(auto &load: loadedFrom) {
+                if(load.second == inst.imm) load.second = -1;
+            }
+        }
+        set<int> live;
+        for(auto succ: block->succs()) live.insert(liveIn[succ].begin(), liveIn[succ].end());
+        for(int i = block->insts.size() - 1; i >= 0; i--) {
+            Inst &inst = block->insts[i];
+            if(inst.op != OP_SLOAD && inst.op != OP_SSTORE) continue;
+            if(!candidates.count(inst.imm)) continue;
+            cost[inst.imm] += weight;
+            if(inst.op == OP_SSTORE) {
+                for(auto other: live) {
+                    if(other != source[i]) interfere(inst.imm, other);
+                }
+                live.erase(inst.imm);
+            }
+            else live.insert(inst.imm);
+        }
+    }
+    // parameters are all written on entry
+    vector<int> params;
+    for(auto slot: candidates) {
+        if(function.slots[slot].param >= 0) params.push_back(slot);
+    }
+    for(auto param: params) {
+        for(auto other: params) interfere(param, other);
+        for(auto other: liveIn[function.entry()]) interfere(param, other);
+    }
+
+    int colors = LAST_SLOT_REGISTER - FIRST_SLOT_REGISTER + 1;
+    // coalesce copied slots that do not interfere, the most frequent copies first; this gives
+    // back what mem2reg split into several values the single slot the variable had
+    vector<pair<double, pair<int, int>>> byWeight;
+    for(auto &copy: copies) byWeight.push_back({-copy.second, copy.first});
+    sort(byWeight.begin(), byWeight.end());
+    map<int, int> merged;
+    auto find = [&](int slot) {
+        while(merged.count(slot)) slot = merged[slot];
+        return slot;
+    };
+    for(auto &copy: byWeight) {
+        int a = find(copy.second.first), b = find(copy.second.second);
+        if(a == b || interference[a].count(b)) continue;
+        // a parameter keeps its slot, which the prologue fills
+        if(function.slots[b].param >= 0) swap(a, b);
+        for(auto neighbour: interference[b]) {
+            interference[neighbour].erase(b);
+            interfere(a, neighbour);
+        }
+        interference.erase(b);
+        cost[a] += cost[b];
+        merged[b] = a;
+    }
+
+    map<int, set<int>> graph = interference;
+    vector<int> order;
+    while(!graph.empty()) {
+        int chosen = -1;
+        for(auto &node: graph) {
+            if(node.second.size() < colors) {
+                chosen = node.first;
+                break;
+            }
+        }
+        if(chosen < 0) {
+            double best = 0;
+            for(auto &node: graph) {
+                double ratio = cost[node.first] / node.second.size();
+                if(chosen < 0 || ratio < best) {
+                    chosen = node.first;
+                    best = ratio;
+                }
+            }
+        }
+        for(auto neighbour: graph[chosen]) graph[neighbour].erase(chosen);
+        graph.erase(chosen);
+        order.push_back(chosen);
+    }
+
+    map<int, int> registers;
+    for(int i = order.size() - 1; i >= 0; i--) {
+        int slot = order[i];
+        set<int> taken;
+        for(auto neighbour: interference[slot]) {
+            if(registers.count(neighbour)) taken.insert(registers[neighbour]);
+        }
+        for(int r = FIRST_SLOT_REGISTER; r <= LAST_SLOT_REGISTER; r++) {
+            if(taken.count(r)) continue;
+            registers[slot] = r;
+            break;
+        }
+    }
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_SLOAD || inst.op == OP_SSTORE) inst.imm = find(inst.imm);
+        }
+    }
+    return registers;
+}
+
+/**
+* Removes the copies between slots that were coalesced or given the same register: stores of a
+* value loaded from the same slot or register, which has not been written since.
+*
+* @param function - The function to rewrite
+* @param registers - The register of every slot that got one
+*
+* @return true if any copy was removed
+*/
+bool removeCoalescedCopies(Function &function, map<int, int> &registers) {
+    // registers are numbered as they are, frame slots below -1
+    auto location = [&](int slot) { return registers.count(slot) ? registers[slot] : -2 - slot; };
+    int removed = 0;
+    for(auto &block: function.blocks) {
+        // loaded value -> where it was loaded from, forgotten once that is written
+        map<int, int> loadedFrom;
+        vector<Inst> kept;
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_SSTORE) {
+                int where = location(inst.imm);
+                if(loadedFrom.count(inst.args[0]) && loadedFrom[inst.args[0]] == where) {
+                    removed++;
+                    continue;
+                }
+                for(auto &load: loadedFrom) {
+                    if(load.second == where) load.second = -1;
+                }
+            }
+            if(inst.op == OP_SLOAD) loadedFrom[inst.dst] = location(inst.imm);
+            kept.push_back(inst);
+        }
+        block->insts = kept;
+    }
+    if(!removed) return false;
+    removeDeadValues(function);
+    return true;
+}
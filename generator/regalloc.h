@@ -0,0 +1,28 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ir.h"
+#include <map>
+using namespace std;
+
+/*
+ * Register allocation for the stack slots of a function (its locals and parameters).
+ *
+ * Slots whose address is never taken are colored with registers $12-$28 by liveness analysis
+ * and graph coloring; slots that do not get a register stay in the frame. These registers are
+ * callee-saved: a procedure saves the ones it uses in its prologue and restores them before
+ * returning, so their values survive calls. Everything else ($1-$11) is caller-saved.
+ *
+ * Values that live across blocks, such as those mem2reg makes of locals, are first turned back
+ * into slots so that they are allocated the same way.
+ */
+const int FIRST_SLOT_REGISTER = 12;
+const int LAST_SLOT_REGISTER = 28;
+// constants that a register holds for the whole program ($0 = 0, $11 = 1, $4 = 4)
+const map<int, int> PINNED = {{0, 0}, {1, 11}, {4, 4}};
+
+void demoteValues(Function&);
+map<int, int> allocateSlotRegisters(Function&);
+bool removeCoalescedCopies(Function&, map<int, int>&);
+
+#endif
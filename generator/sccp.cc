@@ -0,0 +1,353 @@
+#include "irpasses.h"
+#include <climits>
+
+// lattice of a value: not known yet, a single constant, or anything
+enum Lattice {
+    UNDEFINED, CONSTANT, OVERDEFINED,
+};
+
+struct LatticeValue {
+    Lattice state = UNDEFINED;
+    int value = 0;
+};
+
+/**
+* Evaluates an arithmetic or comparison instruction on constant operands, with the semantics of
+* the generated MIPS code: 32-bit wraparound, division truncating towards zero, INT_MIN / -1 ==
+* INT_MIN and INT_MIN % -1 == 0. Division by zero is not folded.
+*
+* @param inst - The instruction
+* @param a - The value of its first operand
+* @param b - The value of its second operand
+* @param result - Set to the result
+*
+* @return true if the instruction could be evaluated
+*/
+bool foldBinary(const Inst &inst, int a, int b, int &result) {
+    unsigned ua = a, ub = b;
+    bool lt = inst.isUnsigned ? ua < ub : a < b;
+    bool gt = inst.isUnsigned ? ua > ub : a > b;
+    switch(inst.op) {
+        case OP_ADD: result = ua + ub; return true;
+        case OP_SUB: result = ua - ub; return true;
+        case OP_MUL: result = ua * ub; return true;
+        case OP_MULHI: result = ((long long)a * b) >> 32; return true;
+        case OP_DIV:
+            if(b == 0) return false;
+            result = a == INT_MIN && b == -1 ? INT_MIN : a / b;
+            return true;
+        case OP_REM:
+            if(b == 0) return false;
+            result = b == -1 ? 0 : a % b;
+            return true;
+        case OP_LT: result = lt; return true;
+        case OP_LE: result = !gt; return true;
+        case OP_GT: result = gt; return true;
+        case OP_GE: result = !lt; return true;
+        case OP_EQ: result = a == b; return true;
+        case OP_NE: result = a != b; return true;
+        default: return false;
+    }
+}
+
+/**
+* Sparse conditional constant propagation (Wegman and Zadeck) over the SSA values and the stack
+* slots of one function. Blocks are only considered once an executable edge reaches them, so
+* values that are constant on every path that can actually run are found even through loops.
+* Slots are tracked flow-insensitively: a slot whose address is never taken and that is only
+* ever assigned one constant reads as that constant.
+*/
+class ConstantPropagation {
+	public:
+		ConstantPropagation(Function &function) : function{function} {}
+		bool run();
+	private:
+		Function &function;
+		vector<LatticeValue> values;
+		map<int, LatticeValue> slots;
+		set<int> addressTaken;
+		set<Block*> executable;
+		set<pair<Block*, Block*>> edges;
+		vector<Block*> blockWork;
+		vector<Inst*> instWork;
+		// value -> instructions using it, slot -> its loads
+		map<int, vector<Inst*>> users;
+		map<int, vector<Inst*>> loads;
+		map<Inst*, Block*> parent;
+
+		void solve();
+		bool lower(LatticeValue&, LatticeValue);
+		void markEdge(Block*, Block*);
+		void visit(Inst*);
+		LatticeValue evaluate(Inst&);
+		bool rewrite();
+};
+
+/**
+* Moves a lattice value down to the meet of itself and another one.
+*
+* @param to - The lattice value to update
+* @param from - The value to merge in
+*
+* @return true if the lattice value changed
+*/
+bool ConstantPropagation::lower(LatticeValue &to, LatticeValue from) {
+    if(from.state == UNDEFINED || to.state == OVERDEFINED) return false;
+    if(to.state == UNDEFINED) {
+        to = from;
+        return true;
+    }
+    if(from.state == CONSTANT && from.value == to.value) return false;
+    to.state = OVERDEFINED;
+    return true;
+}
+
+/**
+* Marks a control flow edge as executable, queueing its target block the first time it is
+* reached and its phis every time a new edge into it is found.
+*
+* @param from - The source block
+* @param to - The target block
+*/
+void ConstantPropagation::markEdge(Block *from, Block *to) {
+    if(!edges.insert({from, to}).second) return;
+    if(executable.insert(to).second) {
+        blockWork.push_back(to);
+        return;
+    }
+    for(auto &inst: to->insts) {
+        if(inst.op == OP_PHI) instWork.push_back(&inst);
+    }
+}
+
+/**
+* Computes the lattice value an instruction defines from the current values of its operands.
+*
+* @param inst - The instruction
+*
+* @return Its lattice value
+*/
+LatticeValue ConstantPropagation::evaluate(Inst &inst) {
+    LatticeValue result;
+    switch(inst.op) {
+        case OP_CONST:
+            result.state = CONSTANT;
+            result.value = inst.imm;
+            return result;
+        case OP_PHI:
+            for(int i = 0; i < inst.args.size(); i++) {
+                if(edges.count({inst.blocks[i], parent[&inst]})) lower(result, values[inst.args[i]]);
+            }
+            return result;
+        case OP_SLOAD:
+            if(addressTaken.count(inst.imm)) break;
+            return slots[inst.imm];
+        default:
+            if(inst.args.size() != 2 || inst.op == OP_STORE) break;
+            LatticeValue a = values[inst.args[0]], b = values[inst.args[1]];
+            if(a.state == OVERDEFINED || b.state == OVERDEFINED) break;
+            if(a.state == UNDEFINED || b.state == UNDEFINED) return result;
+            if(!foldBinary(inst, a.value, b.value, result.value)) break;
+            result.state = CONSTANT;
+            return result;
+    }
+    result.state = OVERDEFINED;
+    return result;
+}
+
+/**
+* Updates the lattice for one instruction and queues whatever depends on the change: the users
+* of its value, the loads of the slot it stores to, or the edges a branch can take.
+*
+* @param inst - The instruction to visit
+*/
+void ConstantPropagation::visit(Inst *inst) {
+    Block *block = parent[inst];
+    if(!executable.count(block)) return;
+    if(inst->op == OP_SSTORE) {
+        if(lower(slots[inst->imm], values[inst->args[0]])) {
+            for(auto load: loads[inst->imm]) instWork.push_back(load);
+        }
+        return;
+    }
+    if(inst->op == OP_BR) {
+        markEdge(block, inst->blocks[0]);
+        return;
+    }
+    if(inst->op == OP_CONDBR) {
+        LatticeValue cond = values[inst->args[0]];
+        if(cond.state == UNDEFINED) return;
+        if(cond.state == OVERDEFINED || cond.value != 0) markEdge(block, inst->blocks[0]);
+        if(cond.state == OVERDEFINED || cond.value == 0) markEdge(block, inst->blocks[1]);
+        return;
+    }
+    if(inst->dst < 0) return;
+    if(lower(values[inst->dst], evaluate(*inst))) {
+        for(auto user: users[inst->dst]) instWork.push_back(user);
+    }
+}
+
+/**
+* Runs the two worklists until neither the lattice nor the set of executable edges changes.
+*/
+void ConstantPropagation::solve() {
+    values.assign(function.valueTypes.size(), LatticeValue());
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            parent[&inst] = block.get();
+            for(auto arg: inst.args) users[arg].push_back(&inst);
+            if(inst.op == OP_SLOAD) loads[inst.imm].push_back(&inst);
+            if(inst.op == OP_ADDR) addressTaken.insert(inst.imm);
+        }
+    }
+    // a parameter holds the argument it arrives with until it is assigned, so it is never one
+    // constant; this also keeps its stores, which the loads of the argument must see
+    for(int i = 0; i < function.slots.size(); i++) {
+        if(function.slots[i].param >= 0) slots[i].state = OVERDEFINED;
+    }
+    executable.insert(function.entry());
+    blockWork.push_back(function.entry());
+    while(!blockWork.empty() || !instWork.empty()) {
+        if(!instWork.empty()) {
+            Inst *inst = instWork.back();
+            instWork.pop_back();
+            visit(inst);
+            continue;
+        }
+        Block *block = blockWork.back();
+        blockWork.pop_back();
+        for(auto &inst: block->insts) visit(&inst);
+    }
+}
+
+/**
+* Replaces every instruction whose value is constant by that constant, stores to slots that are
+* constant, and conditional branches whose condition is constant by unconditional ones. Blocks
+* that can never run are left for removeUnreachableBlocks.
+*
+* @return true if the function was changed
+*/
+bool ConstantPropagation::rewrite() {
+    bool changed = false;
+    for(auto &block: function.blocks) {
+        if(!executable.count(block.get())) continue;
+        vector<Inst> kept, phiConstants;
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_SSTORE && slots[inst.imm].state == CONSTANT && !addressTaken.count(inst.imm)) {
+                changed = true;
+                continue;
+            }
+            if(inst.dst >= 0 && inst.op != OP_CONST && !inst.hasSideEffects() && values[inst.dst].state == CONSTANT) {
+                Inst constant(OP_CONST);
+                constant.dst = inst.dst;
+                constant.imm = values[inst.dst].value;
+                // phis stay at the top of the block, so the constant is placed after them
+                if(inst.op == OP_PHI) phiConstants.push_back(constant);
+                else kept.push_back(constant);
+                changed = true;
+                continue;
+            }
+            kept.push_back(inst);
+        }
+        int phis = 0;
+        while(phis < kept.size() && kept[phis].op == OP_PHI) phis++;
+        kept.insert(kept.begin() + phis, phiConstants.begin(), phiConstants.end());
+        block->insts = kept;
+        Inst &term = block->terminator();
+        if(term.op != OP_CONDBR || values[term.args[0]].state != CONSTANT) continue;
+        Block *taken = term.blocks[values[term.args[0]].value != 0 ? 0 : 1];
+        Block *dropped = term.blocks[values[term.args[0]].value != 0 ? 1 : 0];
+        term.op = OP_BR;
+        term.args.clear();
+        term.blocks = {taken};
+        if(dropped != taken) {
+            for(auto &inst: dropped->insts) {
+                if(inst.op != OP_PHI) continue;
+                for(int i = inst.blocks.size() - 1; i >= 0; i--) {
+                    if(inst.blocks[i] != block.get()) continue;
+                    inst.blocks.erase(inst.blocks.begin() + i);
+                    inst.args.erase(inst.args.begin() + i);
+                }
+            }
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+* Solves the lattice and rewrites the function with what was found.
+*
+* @return true if the function was changed
+*/
+bool ConstantPropagation::run() {
+    solve();
+    bool changed = rewrite();
+    int before = function.blocks.size();
+    removeUnreachableBlocks(function);
+    return changed || function.blocks.size() != before;
+}
+
+/**
+* Checks if an instruction can be deleted when its value is not used. Divisions are kept unless
+* the divisor is a non-zero constant, so that a division by zero still happens at run time.
+*
+* @param inst - The instruction
+* @param constants - The value of every constant in the function
+*
+* @return true if the instruction has no effect besides its value
+*/
+static bool isRemovable(const Inst &inst, map<int, int> &constants) {
+    if(inst.dst < 0 || inst.hasSideEffects() || inst.op == OP_LOAD) return false;
+    if(inst.op != OP_DIV && inst.op != OP_REM) return true;
+    return constants.count(inst.args[1]) && constants[inst.args[1]] != 0;
+}
+
+/**
+* Deletes instructions whose values are never used and that have no side effects, repeating as
+* long as that leaves more values unused.
+*
+* @param function - The function to clean up
+*
+* @return true if any instruction was deleted
+*/
+bool removeDeadValues(Function &function) {
+    bool changed = false;
+    while(true) {
+        map<int, int> useCount, constants;
+        for(auto &block: function.blocks) {
+            for(auto &inst: block->insts) {
+                for(auto arg: inst.args) useCount[arg]++;
+                if(inst.op == OP_CONST) constants[inst.dst] = inst.imm;
+            }
+        }
+        bool progress = false;
+        for(auto &block: function.blocks) {
+            vector<Inst> kept;
+            for(auto &inst: block->insts) {
+                if(isRemovable(inst, constants) && !useCount.count(inst.dst)) progress = true;
+                else kept.push_back(inst);
+            }
+            block->insts = kept;
+        }
+        if(!progress) break;
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+* Folds constant expressions and propagates constants through values, phis and slots, removing
+* branches whose condition is known and the code they make unreachable.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool propagateConstants(Function &function) {
+    function.computePreds();
+    ConstantPropagation sccp(function);
+    bool changed = sccp.run();
+    changed |= removeDeadValues(function);
+    return changed;
+}
@@ -0,0 +1,131 @@
+#include "irpasses.h"
+
+/**
+* Turns conditional branches whose two targets are the same block into unconditional ones.
+*
+* @param function - The function to simplify
+*
+* @return true if a branch was changed
+*/
+static bool foldSameTargetBranches(Function &function) {
+    bool changed = false;
+    for(auto &block: function.blocks) {
+        Inst &term = block->terminator();
+        if(term.op != OP_CONDBR || term.blocks[0] != term.blocks[1]) continue;
+        term.op = OP_BR;
+        term.args.clear();
+        term.blocks.pop_back();
+        // the phis of the target listed this block once per edge
+        for(auto &inst: term.blocks[0]->insts) {
+            if(inst.op != OP_PHI) continue;
+            for(int i = inst.blocks.size() - 1; i > 0; i--) {
+                for(int j = 0; j < i; j++) {
+                    if(inst.blocks[i] == block.get() && inst.blocks[j] == block.get()) {
+                        inst.blocks.erase(inst.blocks.begin() + i);
+                        inst.args.erase(inst.args.begin() + i);
+                        break;
+                    }
+                }
+            }
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+* Merges a block into its predecessor when the predecessor ends in an unconditional branch to it
+* and it has no other predecessor.
+*
+* @param function - The function to simplify
+*
+* @return true if any blocks were merged
+*/
+static bool mergeBlocks(Function &function) {
+    bool changed = false;
+    function.computePreds();
+    for(int b = 0; b < function.blocks.size(); b++) {
+        Block *block = function.blocks[b].get();
+        Inst &term = block->terminator();
+        if(term.op != OP_BR) continue;
+        Block *succ = term.blocks[0];
+        if(succ == block || succ == function.entry() || succ->preds.size() != 1) continue;
+
+        block->insts.pop_back();
+        for(auto &inst: succ->insts) {
+            // a phi with a single predecessor is just a copy
+            if(inst.op == OP_PHI) replaceAllUses(function, inst.dst, inst.args[0]);
+            else block->insts.push_back(inst);
+        }
+        for(auto next: block->succs()) {
+            for(auto &inst: next->insts) {
+                if(inst.op != OP_PHI) continue;
+                for(auto &incoming: inst.blocks) {
+                    if(incoming == succ) incoming = block;
+                }
+            }
+        }
+        for(int i = 0; i < function.blocks.size(); i++) {
+            if(function.blocks[i].get() != succ) continue;
+            function.blocks.erase(function.blocks.begin() + i);
+            if(i < b) b--;
+            break;
+        }
+        function.computePreds();
+        // the merged block may be able to absorb its new successor as well
+        b--;
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+* Makes branches to a block that contains nothing but an unconditional branch go straight to
+* that branch's target. Targets with phis are left alone since the incoming block would change.
+*
+* @param function - The function to simplify
+*
+* @return true if any branch was retargeted
+*/
+static bool forwardEmptyBlocks(Function &function) {
+    bool changed = false;
+    for(auto &empty: function.blocks) {
+        if(empty.get() == function.entry() || empty->insts.size() != 1) continue;
+        Inst &br = empty->terminator();
+        if(br.op != OP_BR || br.blocks[0] == empty.get()) continue;
+        Block *target = br.blocks[0];
+        if(target->insts[0].op == OP_PHI) continue;
+        for(auto &block: function.blocks) {
+            for(auto &succ: block->terminator().blocks) {
+                if(succ != empty.get()) continue;
+                succ = target;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+* Cleans up the control flow graph: folds branches with identical targets, removes unreachable
+* blocks, merges straight-line blocks and bypasses empty ones, until nothing changes.
+*
+* @param function - The function to simplify
+*
+* @return true if the function was changed
+*/
+bool simplifyCFG(Function &function) {
+    bool changed = false;
+    while(true) {
+        int before = function.blocks.size();
+        bool progress = foldSameTargetBranches(function);
+        removeUnreachableBlocks(function);
+        progress |= function.blocks.size() != before;
+        progress |= mergeBlocks(function);
+        progress |= forwardEmptyBlocks(function);
+        if(!progress) break;
+        changed = true;
+    }
+    function.computePreds();
+    return changed;
+}
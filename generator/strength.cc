@@ -0,0 +1,96 @@
+#include "irpasses.h"
+
+// multiplications by up to 2^MAX_DOUBLINGS become additions
+static const int MAX_DOUBLINGS = 4;
+
+/**
+* Returns k if a value is 2^k.
+*
+* @param value - The value
+*
+* @return The exponent, or -1 if the value is not a power of two
+*/
+int exactLog2(int value) {
+    if(value <= 0 || (value & (value - 1))) return -1;
+    int k = 0;
+    while((1 << k) != value) k++;
+    return k;
+}
+
+/**
+* Replaces expensive instructions by cheaper ones:
+*  - x * 2^k (k <= 4), e.g. the scaling of an index into an int*, becomes k doublings x + x
+*  - an exact division by 2^k, e.g. a pointer difference, becomes the high word of x * 2^(32-k)
+*  - a load or store through p + c or p - c with a constant c uses c as the offset of lw/sw
+* The constants and additions left without uses are removed afterwards.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool reduceStrength(Function &function) {
+    map<int, int> constants;
+    map<int, Inst> definitions;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_CONST) constants[inst.dst] = inst.imm;
+            if(inst.op == OP_ADD || inst.op == OP_SUB) definitions.emplace(inst.dst, inst);
+        }
+    }
+    bool changed = false;
+    for(auto &block: function.blocks) {
+        vector<Inst> insts;
+        for(auto inst: block->insts) {
+            if(inst.op == OP_MUL) {
+                int x = inst.args[0], k = -1;
+                if(constants.count(inst.args[1])) k = exactLog2(constants[inst.args[1]]);
+                if(k < 0 && constants.count(inst.args[0])) {
+                    x = inst.args[1];
+                    k = exactLog2(constants[inst.args[0]]);
+                }
+                if(k >= 1 && k <= MAX_DOUBLINGS) {
+                    for(int i = 0; i < k; i++) {
+                        Inst add(OP_ADD);
+                        add.dst = i == k - 1 ? inst.dst : function.newValue(INT);
+                        add.args = {x, x};
+                        insts.push_back(add);
+                        x = add.dst;
+                    }
+                    changed = true;
+                    continue;
+                }
+            }
+            if(inst.op == OP_DIV && inst.isExact && constants.count(inst.args[1])) {
+                int k = exactLog2(constants[inst.args[1]]);
+                if(k >= 2 && k <= 30) {
+                    Inst multiplier(OP_CONST);
+                    multiplier.dst = function.newValue(INT);
+                    multiplier.imm = 1 << (32 - k);
+                    insts.push_back(multiplier);
+                    inst.op = OP_MULHI;
+                    inst.isExact = false;
+                    inst.args[1] = multiplier.dst;
+                    changed = true;
+                }
+            }
+            if(inst.op == OP_LOAD || inst.op == OP_STORE) {
+                int &address = inst.args[inst.op == OP_LOAD ? 0 : 1];
+                while(definitions.count(address)) {
+                    Inst &def = definitions.at(address);
+                    int base = def.args[0], offset = def.args[1];
+                    if(def.op == OP_ADD && !constants.count(offset)) swap(base, offset);
+                    if(!constants.count(offset) || function.valueTypes[base] != INT_STAR) break;
+                    long long imm = inst.imm + (long long)(def.op == OP_ADD ? 1 : -1) * constants[offset];
+                    if(imm < -32768 || imm > 32767) break;
+                    inst.imm = imm;
+                    address = base;
+                    changed = true;
+                }
+            }
+            insts.push_back(inst);
+        }
+        block->insts = insts;
+    }
+    if(changed) removeDeadValues(function);
+    return changed;
+}
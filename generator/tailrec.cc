@@ -0,0 +1,142 @@
+#include "irpasses.h"
+#include "passes.h"
+#include <algorithm>
+
+/**
+* Finds the block a branch ends up in, following blocks that do nothing but branch on.
+*
+* @param target - The block branched to
+*
+* @return The first block on the way that does something, or nullptr if there is a loop
+*/
+static Block *skipEmptyBlocks(Block *target) {
+    set<Block*> seen;
+    while(target->insts.size() == 1 && target->terminator().op == OP_BR) {
+        if(!seen.insert(target).second) return nullptr;
+        target = target->terminator().blocks[0];
+    }
+    return target;
+}
+
+/**
+* Checks if a block only reads slots and returns, like the block after an if that ends in
+* "return r;".
+*
+* @param block - The block
+*
+* @return true if the block can be copied into a predecessor
+*/
+static bool isReturnBlock(Block *block) {
+    for(auto &inst: block->insts) {
+        if(inst.op != OP_SLOAD && inst.op != OP_CONST && inst.op != OP_RET) return false;
+    }
+    return block->terminator().op == OP_RET;
+}
+
+/**
+* Makes a call whose result is assigned to a variable that is then returned a call in tail
+* position, e.g. "if(n > 0) { r = f(n - 1); } else {} return r;". The return block is copied
+* into the block making the call, the load of the variable reads the stored result instead, and
+* the stores left before the return are dropped, as the frame goes away with it.
+*
+* @param function - The function being optimized
+* @param block - The block that may end in such a call
+*
+* @return true if the block now ends in a call whose result is returned
+*/
+static bool exposeTailCall(Function &function, Block *block) {
+    vector<Inst> insts = block->insts;
+    int call = insts.size() - 2;
+    while(call >= 0 && insts[call].op == OP_SSTORE) call--;
+    if(call < 0 || insts[call].op != OP_CALL) return false;
+    if(insts.back().op == OP_BR) {
+        Block *target = skipEmptyBlocks(insts.back().blocks[0]);
+        if(!target || !isReturnBlock(target)) return false;
+        insts.pop_back();
+        map<int, int> values;
+        for(auto inst: target->insts) {
+            if(inst.dst >= 0) inst.dst = values[inst.dst] = function.newValue(function.valueTypes[inst.dst]);
+            for(auto &arg: inst.args) arg = values[arg];
+            insts.push_back(inst);
+        }
+    }
+    // the slots hold what was last stored to them, as no slot has its address taken
+    map<int, int> stored;
+    map<int, int> replaced;
+    vector<Inst> kept;
+    for(int i = 0; i < insts.size(); i++) {
+        Inst inst = insts[i];
+        for(auto &arg: inst.args) {
+            if(replaced.count(arg)) arg = replaced[arg];
+        }
+        if(i > call && inst.op == OP_SLOAD && stored.count(inst.imm)) {
+            replaced[inst.dst] = stored[inst.imm];
+            continue;
+        }
+        if(inst.op == OP_SSTORE) stored[inst.imm] = inst.args[0];
+        kept.push_back(inst);
+    }
+    if(kept.back().args[0] != kept[call].dst) return false;
+    kept.erase(kept.begin() + call + 1, kept.end() - 1);
+    block->insts = kept;
+    return true;
+}
+
+/**
+* Puts calls whose result is returned right away in tail position (see exposeTailCall), where
+* the lowering can jump to the callee instead of calling it, and turns the ones that call the
+* procedure itself into a loop: the arguments are stored to the parameter slots and control goes
+* back to the top of the body, which initializes the locals again. A new, empty entry block is
+* placed in front of the body so that the loop has a header to branch to. Procedures that take
+* the address of a slot are left alone, as a pointer into the frame could still be read after the
+* slot is overwritten.
+*
+* @param function - The function to optimize
+*
+* @return true if the function was changed
+*/
+bool eliminateTailRecursion(Function &function) {
+    if(function.name == "wain") return false;
+    for(auto &block: function.blocks) {
+        for(auto &inst: block->insts) {
+            if(inst.op == OP_ADDR) return false;
+        }
+    }
+    bool changed = false;
+    vector<Block*> tails;
+    for(auto &block: function.blocks) {
+        if(!exposeTailCall(function, block.get())) continue;
+        changed = true;
+        if(block->insts[block->insts.size() - 2].callee == function.name) tails.push_back(block.get());
+    }
+    if(tails.empty()) {
+        if(changed) removeUnreachableBlocks(function);
+        return changed;
+    }
+
+    Block *body = function.entry();
+    body->name = "tailrec";
+    Block *entry = function.newBlock("entry");
+    Inst enter(OP_BR);
+    enter.blocks = {body};
+    entry->insts.push_back(enter);
+    rotate(function.blocks.begin(), function.blocks.end() - 1, function.blocks.end());
+
+    for(auto block: tails) {
+        Inst call = block->insts[block->insts.size() - 2];
+        block->insts.erase(block->insts.end() - 2, block->insts.end());
+        for(int k = 0; k < function.slots.size(); k++) {
+            if(function.slots[k].param < 0) continue;
+            Inst store(OP_SSTORE);
+            store.args = {call.args[function.slots[k].param]};
+            store.imm = k;
+            block->insts.push_back(store);
+        }
+        Inst loop(OP_BR);
+        loop.blocks = {body};
+        block->insts.push_back(loop);
+    }
+    removeUnreachableBlocks(function);
+    PassManager::recordStatistic("tailrec", "calls turned into loops", tails.size());
+    return true;
+}
@@ -0,0 +1,194 @@
+"""
+A small emulator for the MIPS programs the generator prints, used by run.py.
+
+It reads the assembly text, loads wain's arguments the way the CS 241 loaders do (two integers in
+$1 and $2, or an array's address and length), and runs until wain returns to the loader, which
+must find $30 where it set it. The runtime procedures print, init, new and delete are provided by
+the emulator itself; calling one does not count as executing instructions. Every other executed
+instruction is counted, which gives the figure the benchmarks report.
+"""
+import re
+
+MASK = 0xffffffff
+# addresses the runtime procedures are called at, and the one wain returns to
+RUNTIME = {'print': 0xffff0000, 'init': 0xffff0010, 'new': 0xffff0020, 'delete': 0xffff0030}
+RETURN_ADDRESS = 0x8123456c
+STACK_TOP = 0x01000000
+ARRAY_BASE = 0x00100000
+HEAP_BASE = 0x00800000
+MAX_STEPS = 10000000
+
+
+class EmulatorError(Exception):
+    pass
+
+
+def signed(value):
+    value &= MASK
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def register(token):
+    if not re.match(r'^\$\d+$', token) or int(token[1:]) > 31:
+        raise EmulatorError('bad register ' + token)
+    return int(token[1:])
+
+
+def assemble(text):
+    """Turns the assembly text into a list of decoded instructions."""
+    lines = []
+    labels = {}
+    for raw in text.split('\n'):
+        line = raw.split(';')[0].strip()
+        while True:
+            match = re.match(r'^([A-Za-z_][A-Za-z0-9_]*)\s*:\s*(.*)$', line)
+            if not match:
+                break
+            labels[match.group(1)] = len(lines) * 4
+            line = match.group(2).strip()
+        if not line or line.startswith('.import') or line.startswith('.export'):
+            continue
+        lines.append([token for token in re.split(r'[\s,()]+', line) if token])
+
+    def number(token):
+        if re.match(r'^-?\d+$', token):
+            return int(token)
+        if token.startswith('0x'):
+            return int(token, 16)
+        if token in labels:
+            return labels[token]
+        if token in RUNTIME:
+            return RUNTIME[token]
+        raise EmulatorError('bad number or label ' + token)
+
+    code = []
+    for tokens in lines:
+        op = tokens[0]
+        if op == '.word':
+            code.append((op, number(tokens[1])))
+        elif op in ('add', 'sub', 'slt', 'sltu'):
+            code.append((op, register(tokens[1]), register(tokens[2]), register(tokens[3])))
+        elif op in ('mult', 'multu', 'div', 'divu'):
+            code.append((op, register(tokens[1]), register(tokens[2])))
+        elif op in ('mfhi', 'mflo', 'lis', 'jr', 'jalr'):
+            code.append((op, register(tokens[1])))
+        elif op in ('beq', 'bne'):
+            target = tokens[3]
+            offset = (labels[target] - (len(code) * 4 + 4)) // 4 if target in labels else int(target, 0)
+            code.append((op, register(tokens[1]), register(tokens[2]), offset))
+        elif op in ('lw', 'sw'):
+            code.append((op, register(tokens[1]), number(tokens[2]), register(tokens[3])))
+        else:
+            raise EmulatorError('unknown instruction ' + ' '.join(tokens))
+    return code
+
+
+def run(text, a=0, b=0, array=None):
+    """
+    Runs a program with wain(a, b), or wain(array, len(array)) when an array is given.
+
+    Returns what it printed, the value wain returned and the number of instructions executed.
+    """
+    code = assemble(text)
+    regs = [0] * 32
+    memory = {}
+    regs[30] = STACK_TOP
+    regs[31] = RETURN_ADDRESS
+    if array is not None:
+        for i, value in enumerate(array):
+            memory[ARRAY_BASE + 4 * i] = value & MASK
+        regs[1], regs[2] = ARRAY_BASE, len(array)
+    else:
+        regs[1], regs[2] = a & MASK, b & MASK
+    runtime = {address: name for name, address in RUNTIME.items()}
+    heap = HEAP_BASE
+    hi = lo = 0
+    pc = 0
+    steps = 0
+    output = []
+
+    def address(base, offset):
+        location = (regs[base] + offset) & MASK
+        if location % 4:
+            raise EmulatorError('unaligned access at %#x' % location)
+        return location
+
+    while pc != RETURN_ADDRESS:
+        if pc in runtime:
+            name = runtime[pc]
+            if name == 'print':
+                output.append('%d\n' % signed(regs[1]))
+            elif name == 'new':
+                words = signed(regs[1])
+                if words <= 0:
+                    regs[3] = 0
+                else:
+                    regs[3] = heap
+                    heap += 4 * words
+            # the runtime may leave anything in $3, except new, which returns the array in it
+            if name != 'new':
+                regs[3] = 0xdeadbeef
+            pc = regs[31]
+            continue
+        if pc % 4 or not 0 <= pc < 4 * len(code):
+            raise EmulatorError('jump to bad address %#x' % pc)
+        inst = code[pc // 4]
+        pc += 4
+        steps += 1
+        if steps > MAX_STEPS:
+            raise EmulatorError('step limit exceeded')
+        op = inst[0]
+        if op == 'add':
+            regs[inst[1]] = (regs[inst[2]] + regs[inst[3]]) & MASK
+        elif op == 'sub':
+            regs[inst[1]] = (regs[inst[2]] - regs[inst[3]]) & MASK
+        elif op == 'slt':
+            regs[inst[1]] = int(signed(regs[inst[2]]) < signed(regs[inst[3]]))
+        elif op == 'sltu':
+            regs[inst[1]] = int(regs[inst[2]] < regs[inst[3]])
+        elif op in ('mult', 'multu'):
+            x, y = regs[inst[1]], regs[inst[2]]
+            product = signed(x) * signed(y) if op == 'mult' else x * y
+            hi, lo = (product >> 32) & MASK, product & MASK
+        elif op in ('div', 'divu'):
+            x, y = regs[inst[1]], regs[inst[2]]
+            if op == 'div':
+                x, y = signed(x), signed(y)
+            if y == 0:
+                raise EmulatorError('division by zero')
+            quotient = abs(x) // abs(y)
+            if (x < 0) != (y < 0):
+                quotient = -quotient
+            hi, lo = (x - quotient * y) & MASK, quotient & MASK
+        elif op == 'mfhi':
+            regs[inst[1]] = hi
+        elif op == 'mflo':
+            regs[inst[1]] = lo
+        elif op == 'lis':
+            if pc // 4 >= len(code) or code[pc // 4][0] != '.word':
+                raise EmulatorError('lis not followed by .word')
+            regs[inst[1]] = code[pc // 4][1] & MASK
+            pc += 4
+        elif op == '.word':
+            raise EmulatorError('executing data at %#x' % (pc - 4))
+        elif op == 'lw':
+            regs[inst[1]] = memory.get(address(inst[3], inst[2]), 0)
+        elif op == 'sw':
+            memory[address(inst[3], inst[2])] = regs[inst[1]]
+        elif op == 'beq':
+            if regs[inst[1]] == regs[inst[2]]:
+                pc += 4 * inst[3]
+        elif op == 'bne':
+            if regs[inst[1]] != regs[inst[2]]:
+                pc += 4 * inst[3]
+        elif op == 'jr':
+            pc = regs[inst[1]]
+        elif op == 'jalr':
+            target = regs[inst[1]]
+            regs[31] = pc
+            pc = target
+        regs[0] = 0
+    # the loader expects the stack to be as it left it
+    if regs[30] != STACK_TOP:
+        raise EmulatorError('wain returned with $30 at %#x rather than %#x' % (regs[30], STACK_TOP))
+    return ''.join(output), signed(regs[3]), steps
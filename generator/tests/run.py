@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""
+Compiles the test programs with the scanner, parser and generator, runs them in the emulator and
+checks what they print and return against their .expected files.
+
+    python3 tests/run.py                          check every program at -O0, -O1 and -O2
+    python3 tests/run.py "-O1 -disable-pass=licm" check with other generator flags
+    python3 tests/run.py -steps -O0 -O1 -O2       also print the instructions executed by each
+                                                  program, summed over its inputs
+
+Each argument other than -steps is one set of generator flags. A program prog.wlp4 is checked
+against prog.expected, which lists the inputs to run it with, each followed by the lines it must
+print and the value wain must return:
+
+    input 3 4
+    7
+    return 12
+    input array 1 5 3
+
+The second form passes an array and its length to a wain(int*, int). A line
+
+    absent dead-procedures helper
+
+says that whenever the dead-procedures pass runs, no code may be generated for the procedure
+helper. The scanner and parser must be built; run.py is meant to be run from the generator
+directory (make check, make bench).
+"""
+import glob
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mips
+
+TESTS = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(TESTS))
+# terminals of the WLP4 grammar, whose lines in a derivation hold a token rather than a rule
+TERMINALS = set('BOF BECOMES COMMA ELSE EOF EQ GE GT ID IF INT LBRACE LE LPAREN LT MINUS NE NUM PCT '
+                'PLUS PRINTLN RBRACE RETURN RPAREN SEMI SLASH STAR WAIN WHILE AMP LBRACK RBRACK NEW '
+                'DELETE NULL'.split())
+
+
+def preorder(derivation):
+    """
+    Turns the parser's reversed rightmost derivation, where every rule follows the subtrees of
+    its children, into the preorder the generator reads, where it comes before them.
+    """
+    stack = []
+    for line in derivation.split('\n'):
+        parts = line.split()
+        if not parts:
+            continue
+        if parts[0] in TERMINALS and len(parts) == 2:
+            stack.append((line.strip(), []))
+            continue
+        count = len(parts) - 1
+        children = stack[len(stack) - count:] if count else []
+        del stack[len(stack) - count:]
+        stack.append((' '.join(parts), children))
+    lines = []
+
+    def visit(node):
+        lines.append(node[0])
+        for child in node[1]:
+            visit(child)
+    visit(stack[0])
+    return '\n'.join(lines) + '\n'
+
+
+def frontend(source):
+    """Scans and parses a program, returning the .wlp4i the generator reads."""
+    tokens = subprocess.run([os.path.join(ROOT, 'scanner', 'scanner')], input=source, capture_output=True,
+                            text=True, check=True).stdout
+    # the scanner reports the literal 0 as ZERO, which the grammar knows as a NUM
+    tokens = tokens.replace('ZERO 0', 'NUM 0')
+    parsed = subprocess.run(['./parser'], input=tokens, capture_output=True, text=True,
+                            cwd=os.path.join(ROOT, 'parser'), check=True)
+    if parsed.stderr:
+        raise Exception('parse error: ' + parsed.stderr)
+    return preorder(parsed.stdout)
+
+
+def read_expected(path):
+    """
+    Returns the (arguments, is array, expected output) of every input of a program, and the
+    (pass, procedure) of every procedure the pass must remove.
+    """
+    cases = []
+    absent = []
+    for line in open(path).read().split('\n'):
+        if not line.strip():
+            continue
+        words = line.split()
+        if words[0] == 'input':
+            array = len(words) > 1 and words[1] == 'array'
+            cases.append([[int(word) for word in words[2 if array else 1:]], array, ''])
+        elif words[0] == 'absent':
+            absent.append((words[1], words[2]))
+        else:
+            cases[-1][2] += line + '\n'
+    return cases, absent
+
+
+def pass_levels():
+    """Returns the lowest -O level that runs each pass, from the generator's -print-passes."""
+    listing = subprocess.run([os.path.join(ROOT, 'generator', 'generator'), '-print-passes'], capture_output=True,
+                             text=True, check=True).stdout
+    return {line.split()[0]: int(line.split()[1][2:]) for line in listing.split('\n') if line.strip()}
+
+
+def runs_pass(name, flags, levels):
+    """Checks if a set of generator flags runs a pass, the way the pass manager decides it."""
+    level = 0
+    # the last -enable-pass or -disable-pass naming the pass decides, if any does
+    chosen = None
+    for flag in flags:
+        if flag in ('-O0', '-O1', '-O2'):
+            level = int(flag[2])
+        elif flag.startswith('-enable-pass=') and name in flag[len('-enable-pass='):].split(','):
+            chosen = True
+        elif flag.startswith('-disable-pass=') and name in flag[len('-disable-pass='):].split(','):
+            chosen = False
+    return levels[name] <= level if chosen is None else chosen
+
+
+def check(name, wlp4i, cases, absent, flags, levels):
+    """Compiles and runs one program with one set of flags; returns an error or the step count."""
+    generated = subprocess.run([os.path.join(ROOT, 'generator', 'generator')] + flags, input=wlp4i,
+                               capture_output=True, text=True)
+    if generated.returncode != 0 or 'ERROR' in generated.stderr or 'SomethingNotRight' in generated.stderr:
+        return 'generator failed: ' + generated.stderr[-1000:], 0
+    labels = set(line.split(':')[0].strip() for line in generated.stdout.split('\n') if ':' in line)
+    for pass_name, procedure in absent:
+        if runs_pass(pass_name, flags, levels) and 'F' + procedure in labels:
+            return '%s left code for %s' % (pass_name, procedure), 0
+    total = 0
+    for args, array, expected in cases:
+        try:
+            if array:
+                output, result, steps = mips.run(generated.stdout, array=args)
+            else:
+                output, result, steps = mips.run(generated.stdout, args[0], args[1])
+        except mips.EmulatorError as error:
+            return 'on input %s: %s' % (args, error), 0
+        output += 'return %d\n' % result
+        if output != expected:
+            return 'on input %s: expected\n%sgot\n%s' % (args, expected, output), 0
+        total += steps
+    return None, total
+
+
+def main():
+    args = sys.argv[1:]
+    steps = '-steps' in args
+    configs = [arg for arg in args if arg != '-steps'] or ['-O0', '-O1', '-O2']
+    programs = sorted(glob.glob(os.path.join(TESTS, '*', '*.wlp4')))
+    levels = pass_levels()
+    failed = 0
+    counts = {}
+    for path in programs:
+        name = os.path.relpath(path, TESTS)
+        wlp4i = frontend(open(path).read())
+        cases, absent = read_expected(path[:-len('.wlp4')] + '.expected')
+        for config in configs:
+            error, total = check(name, wlp4i, cases, absent, config.split(), levels)
+            if error:
+                failed += 1
+                print('FAIL %s %s: %s' % (name, config, error))
+            counts[name, config] = total
+    if steps:
+        width = max(len(config) for config in configs) + 2
+        print('%-24s' % 'instructions executed' + ''.join(config.rjust(max(width, 12)) for config in configs))
+        for path in programs:
+            name = os.path.relpath(path, TESTS)
+            print('%-24s' % name + ''.join(str(counts[name, config]).rjust(max(width, 12)) for config in configs))
+        print('%-24s' % 'total' + ''.join(str(sum(counts[os.path.relpath(path, TESTS), config] for path in programs))
+                                          .rjust(max(width, 12)) for config in configs))
+    print('%d of %d runs failed' % (failed, len(programs) * len(configs)) if failed else
+          'all %d runs passed' % (len(programs) * len(configs)))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,5 +1,6 @@
 #include "wlp4gen.h"
 #include "tree.h"
+#include "parallel.h"
 
 /**
 * Prints the procedures and variables table to standard error.
@@ -44,7 +45,7 @@ bool Compiler::variableExists(string function, string var) {
 }
 
 /**
-* Checks if a function exists. 
+* Checks if a function exists, i.e. it is declared before or is the procedure being compiled.
 * 
 * @param function - The name of the function.
 * 
@@ -52,7 +53,7 @@ bool Compiler::variableExists(string function, string var) {
 */
 bool Compiler::functionExists(string function) {
     if(procedures.find(function) == procedures.end()) return false;
-    return true;
+    return declared[function] <= index;
 }
 
 /**
@@ -76,183 +77,261 @@ Type Compiler::getType(Node *node) {
 */
 string Compiler::getIDValue(Node *node) { return node->children[0]->rule; }
 
+
 /**
-* Creates and writes the offset table to cerr. 
-* This is used to determine which variables are part of the function
+* Returns the IR built by compile.
 *
-* @param function - name of the function
+* @return The module holding one function per procedure, in source order
 */
-void Compiler::makeOffsetTable(string function) {
-    map<string, int> newOffsets;
-    cerr << "Offset Table:" << endl;
-    for(auto out = procedures.begin(); out != procedures.end(); out++) {
-        string function = out->first;
-        std::cerr << function << ":" << endl;
-        for (auto it = varOrder.begin(); it != varOrder.end(); ++it){
-            if(it->first == function) {
-                // auto internal_map = it->second;
-                int numVars = it->second.size();
-                int count = 0;
-                // cerr << "num: " << numVars << endl;
-                for(int i = 0; i < numVars; i++) {
-                    string var = varOrder[function][i];
-                    varOffset[function][var] = 4*count;
-                    --count;
-                    cerr << var << " ";
-                    std::cerr << varOffset[function][var] << endl;
-                }
-            }
+Module &Compiler::getModule() { return module; }
+
+/**
+* Sets how many procedure bodies are compiled at the same time.
+*
+* @param count - The number of threads
+*/
+void Compiler::setThreads(int count) { threads = count; }
+
+/**
+* Starts building a new function and makes its entry block current.
+*
+* @param function - The name of the procedure
+*/
+void Compiler::beginFunction(string function) {
+    module.functions.push_back(make_unique<Function>());
+    current = module.functions.back().get();
+    current->name = function;
+    layout.clear();
+    setBlock(current->newBlock("entry"));
+}
+
+/**
+* Finishes the current function: blocks are laid out in the order they were filled, so the code
+* for a statement follows the code before it.
+*/
+void Compiler::endFunction() {
+    vector<unique_ptr<Block>> ordered;
+    for(auto b: layout) {
+        for(auto &owned: current->blocks) {
+            if(owned.get() == b) ordered.push_back(move(owned));
         }
     }
+    current->blocks = move(ordered);
+    current->params = procedures[current->name];
+    current->computePreds();
 }
 
 /**
-* Generates asm prologue for function. 
-* 
-* @param function - Name of the function that is being compiled
+* Adds a variable to the symbol table of a function and gives it a stack slot.
+*
+* @param function - The name of the function
+* @param variable - The name of the variable
+* @param type - The type of the variable
+* @param param - The index of the parameter, or -1 for a local declared in dcls
 */
-void Compiler::generatePrologue(string function) {
-    cout << "; begin prologue:\n" << ".import print\n" 
-    << ".import init\n"
-    << ".import new\n"
-    << ".import delete\n"
-    << "lis $4 \t\t\t\t; $4 <- 4\n" 
-    ".word 4\n" << "sub $29 , $30 , $4 \t; init frame pointer\n";
-    cout << "lis $10\n.word print\n";
-    cout << "lis $11\n.word 1\n";
+void Compiler::declareVariable(string function, string variable, Type type, int param) {
+    if(variableExists(function, variable)) {
+        errors << "SomethingNotRight: redeclaration of variable \""
+            << variable << "\" in function \"" << function << "\"" << endl;
+        return;
+    }
+    varOrder[function].push_back(variable);
+    variables[function].insert(pair<string, Type>(variable, type));
+    varSlot[function][variable] = current->slots.size();
+    current->slots.push_back({variable, type, param});
 }
 
 /**
-* Generate the asm epilogue for a function. This is used to add variables to the output file.
-* 
-* @param function - The name of the function that is being compiled
+* Makes a block the one new instructions are appended to.
+*
+* @param next - The block to fill
 */
-void Compiler::generateEpilogue(string function) {
-    cout << "\n; begin epilogue:" << endl;
-    int numVars = varOffset[function].size();
-    for(int i = 0; i < numVars; ++i) cout << "add $30 , $30 , $4\n";
-    cout << "jr $31\n";
+void Compiler::setBlock(Block *next) {
+    block = next;
+    layout.push_back(next);
 }
 
 /**
-* Prints code for a function. 
-* 
-* @param function - The name of the function. E. g. " c "
-* @param variable - The name of the variable
+* Appends an instruction that defines a new value to the current block.
+*
+* @param op - The opcode
+* @param type - The type of the value
+* @param args - The operands
+* @param imm - The immediate (constant value or slot)
+*
+* @return The value defined by the instruction
 */
-void Compiler::code(string function, string variable) {
-    int offset = varOffset[function][variable];
-    cout << "lw $3, " << offset << "($29)\n";
+Value Compiler::emit(Opcode op, Type type, vector<int> args, int imm) {
+    Inst inst(op);
+    inst.dst = current->newValue(type);
+    inst.args = args;
+    inst.imm = imm;
+    block->insts.push_back(inst);
+    return {inst.dst, type};
 }
 
 /**
-* Asm for pushing a value onto the stack. 
-* 
-* @param reg - The register to push onto ( 0 - 3
+* Appends an instruction that does not define a value to the current block.
+*
+* @param op - The opcode
+* @param args - The operands
+* @param imm - The immediate (slot)
 */
-void Compiler::push(int reg) {
-    cout << "sw $" << reg << " , -4($30)\n";
-    cout << "sub $30, $30, $4\n";
+void Compiler::emitEffect(Opcode op, vector<int> args, int imm) {
+    Inst inst(op);
+    inst.args = args;
+    inst.imm = imm;
+    block->insts.push_back(inst);
 }
 
 /**
-* Pop a value from a register. 
-* 
-* @param reg - The register to pop from.
+* Ends the current block with a branch or return.
+*
+* @param op - BR, CONDBR or RET
+* @param args - The condition or the returned value
+* @param targets - The blocks the branch goes to
 */
-void Compiler::pop(int reg) {
-    cout << "add $30, $30, $4\n";
-    cout << "lw $" << reg << " , -4($30)\n";
+void Compiler::emitBranch(Opcode op, vector<int> args, vector<Block*> targets) {
+    Inst inst(op);
+    inst.args = args;
+    inst.blocks = targets;
+    block->insts.push_back(inst);
 }
 
 /**
-* Generates code that will be used to generate a constant.
-* 
-* @param value - The value of the constant to generate. Should be a string
+* Materializes a constant.
+*
+* @param value - The value of the constant
+* @param type - INT, or INT_STAR for NULL
+*
+* @return The constant value
 */
-void Compiler::constantGenerator(string value) {
-    cout << "lis $5\n";
-    cout << ".word " << value << endl;
-    // push(5);
+Value Compiler::constant(int value, Type type) {
+    return emit(OP_CONST, type, {}, value);
 }
 
 /**
-* Returns a unique label that is used to identify a function. This is the same 
-* as label + 1 but can be used as a label for an anonymous function.
+* Multiplies an int by 4 so it can be added to a pointer. The instructions are placed at the
+* given position of the current block, right after the code that computed the int, so that
+* the int is consumed before the other operand is evaluated.
 *
-* @param label - The label to be used. Must not be null.
-* 
-* @return A unique label that is used to identify a function
+* @param index - The int to scale
+* @param position - Where in the current block to insert the scaling code
+*
+* @return The scaled value
 */
-string Compiler::getUniqueLabel(string label) {
-    ++labelCount;
-    return label + to_string(labelCount);
+Value Compiler::scale(Value index, int position) {
+    vector<Inst> tail(block->insts.begin() + position, block->insts.end());
+    block->insts.erase(block->insts.begin() + position, block->insts.end());
+    Value four = constant(4);
+    Value scaled = emit(OP_MUL, INT, {index.id, four.id});
+    block->insts.insert(block->insts.end(), tail.begin(), tail.end());
+    return scaled;
 }
 
 /**
 * Compile the AST from the given node. This is the top - level function called by main.
+*
+* The signatures of all procedures are collected first, in source order. Every body only needs
+* those, so the bodies are then compiled in parallel, each by its own Compiler, and the functions
+* and diagnostics are gathered in source order, giving the same result as a serial run.
 * 
 * @param node - The node to compile
 */
 void Compiler::compile(Node *node) {
-    int size = node->children.size();
-    // Compiles the procedures procedure main and procedures.
-    for(int i = size-1; i >=0; i--) {
-        if(node->children[i]->rule == "procedures") compile(node->children[i].get());
-        else if(node->children[i]->rule == "procedure") compileProcedure(node->children[i].get());
-        else if(node->children[i]->rule == "main") compileMain(node->children[i].get());
+    vector<Node*> nodes;
+    collectProcedures(node, nodes);
+    for(int i = 0; i < nodes.size(); i++) declareProcedure(nodes[i], i);
+
+    vector<Compiler> workers(nodes.size());
+    parallelFor(nodes.size(), threads, [&](int i) {
+        Compiler &worker = workers[i];
+        worker.procedures = procedures;
+        worker.declared = declared;
+        worker.index = i;
+        if(nodes[i]->rule == "main") worker.compileMain(nodes[i]);
+        else worker.compileProcedure(nodes[i]);
+    });
+    for(auto &worker: workers) {
+        errors << worker.errors.str();
+        for(auto &function: worker.module.functions) module.functions.push_back(move(function));
+        for(auto &table: worker.variables) variables[table.first] = table.second;
+    }
+    cerr << errors.str();
+}
+
+/**
+* Collects the procedure and main nodes in source order.
+*
+* @param node - The start or procedures node
+* @param nodes - Where the nodes are stored
+*/
+void Compiler::collectProcedures(Node *node, vector<Node*> &nodes) {
+    for(auto &child: node->children) {
+        if(child->rule == "procedures") collectProcedures(child.get(), nodes);
+        else if(child->rule == "procedure" || child->rule == "main") nodes.push_back(child.get());
     }
 }
 
 /**
-* compiles the wain (wlp4 main) program and prints the prologue to standard output
+* Records the signature of a procedure or of wain.
+*
+* @param node - The procedure or main node
+* @param position - The position of the procedure in the source
+*/
+void Compiler::declareProcedure(Node *node, int position) {
+    index = position;
+    string id = node->rule == "main" ? "wain" : getIDValue(node->children[1].get());
+    if(functionExists(id))
+        errors << "SomethingNotRight: redeclaration of function: \"" << id << "\"" << endl;
+    procedures[id].clear();
+    declared[id] = position;
+    if(node->rule != "main") {
+        declareParams(node->children[3].get(), id);
+        return;
+    }
+    for(auto &it: node->children) {
+        if(it->rule != "dcl") continue;
+        procedures[id].push_back(getType(it->children[0].get()));
+        if(procedures[id].size() > 2) errors << "SomethingNotRight: passing more than two args for wain" << endl;
+        if(procedures[id].size() == 2 && procedures[id][1] != INT)
+            errors << "SomethingNotRight: second arg for wain cannot be of type \"INT*\" " << endl;
+    }
+}
+
+/**
+* Records the parameter types of a procedure.
+*
+* @param node - The params or paramlist node
+* @param id - The name of the procedure
+*/
+void Compiler::declareParams(Node *node, string id) {
+    for(auto &it: node->children) {
+        if(it->rule == "params" || it->rule == "paramlist") declareParams(it.get(), id);
+        if(it->rule == "dcl") procedures[id].push_back(getType(it->children[0].get()));
+    }
+}
+
+/**
+* compiles the wain (wlp4 main) program
 * 
 * @param node - * pointer to the node to be examined
 */
 void Compiler::compileMain(Node *node) {
-    int count = 0;
-    generatePrologue("wain");
-    cout << "wain" << ":" << endl;
-	cout << "sub $29, $30, $4" << endl;
+    beginFunction("wain");
     for(auto &it: node->children) {
-        if(it->rule == "dcl") {
-            count++;
-            if(count == 1) {
-                // if program is called with twoints, put 0 in $2
-                push(2);
-                if(it->children[0]->children.size() == 1) cout << "add $2, $0, $0\n";
-                push(31);
-                push(29);
-                cout << "lis $5\n";
-                cout << ".word init\n";
-                cout << "jalr $5\n";
-                pop(29);
-                pop(31);
-                pop(2);
-            }
-            if(count > 2) cerr << "SomethingNotRight: passing more than two args for wain" << endl;
-            compileDcl(it.get(), "wain", true);
-            if(count == 2 && procedures["wain"][1] != INT)
-                cerr << "SomethingNotRight: second arg for wain cannot be of type \"INT*\" " << endl;
-            push(count);
-        }
-        if(it->rule == "dcls") {
-            compileDcls(it.get(), "wain");
-            makeOffsetTable("wain");
-            cout << "; end prologue\n";
-        }
+        if(it->rule == "dcl") compileDcl(it.get(), "wain", true);
+        if(it->rule == "dcls") compileDcls(it.get(), "wain");
         if(it->rule == "statements") compileStatements(it.get(), "wain");
         if(it->rule == "expr") {
-            if(compileExpr(it.get(), "wain") != INT) {
-                cerr << "SomethingNotRight: wain must return type \"INT\"" << endl;
+            Value retval = compileExpr(it.get(), "wain");
+            if(retval.type != INT) {
+                errors << "SomethingNotRight: wain must return type \"INT\"" << endl;
             }
-            // generateEpilogue("wain");
+            emitBranch(OP_RET, {retval.id}, {});
         }
     }
-    int numVars = varOffset["wain"].size();
-    // cerr << "numvars: " << numVars << endl;
-    for(int i = 0; i < numVars; ++i) pop(5);
-    cout << "jr $31\n";
+    endFunction();
 }
 
 /**
@@ -262,25 +341,20 @@ void Compiler::compileMain(Node *node) {
 */
 void Compiler::compileProcedure(Node *node) {
     string id = getIDValue(node->children[1].get());
-    if(functionExists(id)) 
-        cerr << "SomethingNotRight: redeclaration of function: \"" << id << "\"" << endl;
-    cout << id << ":\n";
-    cout << "sub $29, $30, $4\n";
-    procedures[id];
+    beginFunction(id);
     for(auto &it: node->children) {
         if(it->rule == "params") compileParams(it.get(), id);
-        if(it->rule == "dcls") {
-            compileDcls(it.get(), id);
-            makeOffsetTable(id);  
-        }
+        if(it->rule == "dcls") compileDcls(it.get(), id);
         if(it->rule == "statements") compileStatements(it.get(), id);
         if(it->rule == "expr") {
+            Value retval = compileExpr(it.get(), id);
+            if(retval.type != INT) {
+                errors << "SomethingNotRight: \"" << id << "\" must return type \"INT\"" << endl;
+            }
+            emitBranch(OP_RET, {retval.id}, {});
         }
     }
-    int numVars = varOffset[id].size();
-    // cerr << "numvars: " << numVars << endl;
-    for(int i = 0; i < numVars; ++i) pop(5);
-    cout << "jr $31\n";
+    endFunction();
 }
 
 /**
@@ -305,20 +379,16 @@ void Compiler::compileParams(Node* node, string id) {
 * @param isParam - true if function is a parameter false if not
 */
 void Compiler::compileDcl(Node* node, string function, bool isParam) {
-    for (auto &it: node->children) {
-        Type type = getType(node->children[0].get());
-        string id = getIDValue(node->children[1].get());
-        if(variableExists(function, id)) cerr << "SomethingNotRight: redeclaration of variable \""
-            << id << "\" in function \"" << function << "\"" << endl;
-        map<string, Type> insert;
-
-        varOrder[function].push_back(id);
-        insert[id] = type;
-        if(isParam) procedures[function].push_back(type);
-        variables[function]
-            .insert(pair<string, Type>(id, type));
-        break;
+    Type type = getType(node->children[0].get());
+    string id = getIDValue(node->children[1].get());
+    int param = -1;
+    if(isParam) {
+        param = 0;
+        for(auto &slot: current->slots) {
+            if(slot.param >= 0) param++;
+        }
     }
+    declareVariable(function, id, type, param);
 }
 
 /**
@@ -333,33 +403,22 @@ void Compiler::compileDcls(Node* node, string function) {
         compileDcls(node->children[0].get(), function);
         auto cur = node->children[1].get();
         Type type = getType(cur->children[0].get());
+        string variable = getIDValue(cur->children[1].get());
+        declareVariable(function, variable, type, -1);
 
+        Value init = {-1, INT};
         if (node->rule == "dcls" && node->children.size() == 5) {
             if(node->children[3]->rule == "NUM") {
-                if(type != INT) cerr << "SomethingNotRight: cannot assign \"INT\" value to \"INT*\"" << endl;
-                // cerr << "num: " << node->children[3]->children[0]->rule << endl;
+                if(type != INT) errors << "SomethingNotRight: cannot assign \"INT\" value to \"INT*\"" << endl;
                 string constant = node->children[3]->children[0]->rule;
-                constantGenerator(constant);
-                push(5);
+                init = this->constant(stoll(constant), INT);
             }
             else if(node->children[3]->rule == "NULL") {
-                // string constant = node->children[3]->children[0]->rule;
-                // constantGenerator(constant);
-                // cout << "add $3, $0, $11\n";
-                push(11);
-                if(type != INT_STAR) cerr << "SomethingNotRight: cannot assign \"INT*\" value to \"INT\"" << endl;
+                init = constant(1, INT_STAR);
+                if(type != INT_STAR) errors << "SomethingNotRight: cannot assign \"INT*\" value to \"INT\"" << endl;
             }
         }
-        string variable = getIDValue(cur->children[1].get());
-
-        if(variableExists(function, variable)) cerr << "SomethingNotRight: redeclaration of variable \""
-            << variable << "\" in function \"" << function << "\"" << endl;
-
-        varOrder[function].push_back(variable);
-        map<string, Type> insert;
-        insert[variable] = type;
-        variables[function]
-            .insert(pair<string, Type>(variable, type));
+        if(init.id >= 0) emitEffect(OP_SSTORE, {init.id}, varSlot[function][variable]);
     }
 }
 
@@ -376,236 +435,220 @@ void Compiler::compileStatements(Node* node, string function) {
         compileStatements(node->children[1].get(), function);    
     }
     if(node->children[0]->rule == "IF") {
-        string elseLabel = getUniqueLabel("else");
-        string end = getUniqueLabel("endif");
-        compileTest(node->children[2].get(), function);
-        cout << "beq $3, $0, " << elseLabel << endl;
+        Value test = compileTest(node->children[2].get(), function);
+        Block *thenBlock = current->newBlock("then");
+        Block *elseBlock = current->newBlock("else");
+        Block *end = current->newBlock("endif");
+        emitBranch(OP_CONDBR, {test.id}, {thenBlock, elseBlock});
+        setBlock(thenBlock);
         compileStatements(node->children[5].get(), function);
-        cout << "beq $0, $0, " << end << endl;
-        cout << elseLabel << ":\n";
+        emitBranch(OP_BR, {}, {end});
+        setBlock(elseBlock);
         compileStatements(node->children[9].get(), function);
-        cout << end << ":\n";
+        emitBranch(OP_BR, {}, {end});
+        setBlock(end);
     }
     if(node->children[0]->rule == "WHILE") {
-        string loop = getUniqueLabel("loop");
-        string endWhile = getUniqueLabel("endWhile");
-        cout << loop << ":\n";
-        compileTest(node->children[2].get(), function);
-        cout << "beq $3, $0, " << endWhile << endl;
+        Block *loop = current->newBlock("loop");
+        Block *body = current->newBlock("body");
+        Block *endWhile = current->newBlock("endWhile");
+        emitBranch(OP_BR, {}, {loop});
+        setBlock(loop);
+        Value test = compileTest(node->children[2].get(), function);
+        emitBranch(OP_CONDBR, {test.id}, {body, endWhile});
+        setBlock(body);
         compileStatements(node->children[5].get(), function);
-        cout << "beq $0, $0, " << loop << endl;
-        cout << endWhile << ":\n";
+        emitBranch(OP_BR, {}, {loop});
+        setBlock(endWhile);
     }
     if(node->children[0]->rule == "PRINTLN") {
-        push(1);
-        if(compileExpr(node->children[2].get(), function) != INT)
-            cerr << "SomethingNotRight: \"println\" cannot be used with type \"INT*\"" << endl;
-        cout << "add $1, $3, $0\n";
-        push(31);
-        cout << "lis $5\n.word print\njalr $5\n";
-        pop(31);
-        pop(1);
+        Value value = compileExpr(node->children[2].get(), function);
+        if(value.type != INT)
+            errors << "SomethingNotRight: \"println\" cannot be used with type \"INT*\"" << endl;
+        emitEffect(OP_PRINT, {value.id});
     }
     if(node->children[0]->rule == "DELETE") {
-        Type exprRetval = compileExpr(node->children[3].get(), function);
-        string label = getUniqueLabel("skipDelete");
-        cout << "beq $3, $11, " << label << endl;
-        cout << "add $1, $3, $0\n";
-        push(31);
-        cout << "lis $5\n";
-        cout << ".word delete\n";
-        cout << "jalr $5\n";
-        pop(31);
-        cout << label << ":" << endl;
-
-        if(exprRetval != INT_STAR)
-            cerr << "SomethingNotRight: \"delete\" cannot be used with type \"INT\"" << endl;
+        Value value = compileExpr(node->children[3].get(), function);
+        if(value.type != INT_STAR)
+            errors << "SomethingNotRight: \"delete\" cannot be used with type \"INT\"" << endl;
+        emitEffect(OP_DELETE, {value.id});
     }
     if(node->children[0]->rule == "lvalue") {
-        Type right = compileExpr(node->children[2].get(), function);
-        cout << "; here\n";
-        push(3);
-        Type left = compileLValue(node->children[0].get(), function);
-        pop(5);
-        string variable = node->children[0]->children[0]->children[0]->rule;
-        
-        int offset = varOffset[function][variable];
-        if(node->children[0]->children.size() == 1) cout << "sw $5, " << offset << " ($29)\n" << endl;
-        else if(node->children[0]->children.size() == 2) cout << "sw $5, 0($3)" << endl;
-        if(left != right) {
-            cerr << "SomethingNotRight: lvalue does not match " << endl;
+        Value right = compileExpr(node->children[2].get(), function);
+        Location left = compileLValue(node->children[0].get(), function);
+        if(left.slot >= 0) emitEffect(OP_SSTORE, {right.id}, left.slot);
+        else emitEffect(OP_STORE, {right.id, left.address});
+        if(left.type != right.type) {
+            errors << "SomethingNotRight: lvalue does not match " << endl;
         }
     }
-    for (auto &it: node->children) {
-        if(it->rule == "test") compileTest(it.get(), function);
-        // if(it->rule == "statements") compileStatements(it.get(), function);
-    }
 }
 
 /**
-* Compiles an lvalue and returns the type of the result.
+* Compiles an lvalue and returns where it is stored.
 * 
 * @param node - * pointer to the node that is going to be compiled
 * @param function - name of the function that is being compiled
 * 
-* @return the type of the lvalue or INT if there is
+* @return the slot of the variable, or the address that is dereferenced, and the type stored there
 */
-Type Compiler::compileLValue(Node* node, string function) {
+Location Compiler::compileLValue(Node* node, string function) {
     if(node->children.size() == 1) {
         string variable = getIDValue(node->children[0].get());
-        return variables[function][variable];
+        if(!variableExists(function, variable)) {
+            errors << "SomethingNotRight: variable \""
+            << variable << "\" not declared in function \"" << function << "\"" << endl;
+            return {-1, constant(1, INT_STAR).id, INT};
+        }
+        return {varSlot[function][variable], -1, variables[function][variable]};
     }
     if(node->children.size() == 2) {
-        cout << ";in lvalue\n";
-        Type retval = compileFactor(node->children[1].get(), function);
-        if(retval == INT_STAR) return INT;
-        cerr << "SomethingNotRight: cannot dereference an integer" << endl;
+        Value address = compileFactor(node->children[1].get(), function);
+        if(address.type != INT_STAR) errors << "SomethingNotRight: cannot dereference an integer" << endl;
+        return {-1, address.id, INT};
     }
-    if(node->children.size() == 3) return compileLValue(node->children[1].get(), function);
+    return compileLValue(node->children[1].get(), function);
+}
+
+/**
+* Computes the Sethi-Ullman number of an expression: how many registers are needed to evaluate
+* it without spilling. Operands of a binary operator are evaluated larger need first when both
+* are pure, since the result of the first one occupies a register while the second is computed.
+*
+* @param node - An expr, term, factor or lvalue node
+*
+* @return The number of registers needed
+*/
+int Compiler::registerNeed(Node *node) {
+    if(node->rule == "expr" || node->rule == "term") {
+        if(node->children.size() == 1) return registerNeed(node->children[0].get());
+        int left = registerNeed(node->children[0].get());
+        int right = registerNeed(node->children[2].get());
+        return left == right ? left + 1 : max(left, right);
+    }
+    if(node->rule == "factor" || node->rule == "lvalue") {
+        string first = node->children[0]->rule;
+        if(first == "LPAREN") return registerNeed(node->children[1].get());
+        if(first == "STAR" || first == "AMP") return registerNeed(node->children[1].get());
+    }
+    return 1;
 }
 
 /**
-* Compiles testing expressions and outputs the result to standard output. 
+* Checks if evaluating an expression has no side effects, so it may be evaluated before or
+* after its sibling without changing what the program does. Calls may print and new allocates.
+*
+* @param node - The node to check
+*
+* @return true if the expression contains no procedure call and no new
+*/
+bool Compiler::isPure(Node *node) {
+    if(node->rule == "NEW") return false;
+    if(node->rule == "factor" && node->children[0]->rule == "ID" && node->children.size() > 1) return false;
+    for(auto &child: node->children) {
+        if(!isPure(child.get())) return false;
+    }
+    return true;
+}
+
+/**
+* Compiles testing expressions to a value that is 1 if the test holds and 0 otherwise.
 * 
 * @param node - * The node to compile. This is the root of the tree being compiled.
 * @param function - The function being compiled
+*
+* @return The result of the comparison
 */
-void Compiler::compileTest(Node* node, string function) {
-    Type left = compileExpr(node->children[0].get(), function);
-    push(3);
+Value Compiler::compileTest(Node* node, string function) {
+    Node *leftNode = node->children[0].get();
+    Node *rightNode = node->children[2].get();
     string middle = node->children[1]->rule;
-    Type right = compileExpr(node->children[2].get(), function);
-    pop(5);
-
-    string what;
-    if(left == INT_STAR) what = "sltu";
-    else if(left == INT) what = "slt";
-
-    if(middle == "LT") cout << what << " $3, $5, $3\n";
-    if(middle == "GT") cout << what << " $3, $3, $5\n";
-    if(middle == "GE") {
-        cout << what << " $3, $5, $3\n";
-        cout << "sub $3, $11, $3\n";
-    }
-    if(middle == "LE") {
-        cout << what << " $3, $3, $5\n";
-        cout << "sub $3, $11, $3\n";
-    }
-    if(middle == "NE") {
-        cout << "slt $6, $3, $5\t\t\t\t\t; $6 = $3 < $5\n";
-        cout << "slt $7, $5, $3\t\t\t\t\t; $7 = $5 < $3\n";
-        cout << "add $3, $6, $7\n";
-    }
-    if(middle == "EQ") {
-        cout << "slt $6, $3, $5\t\t\t\t\t; $6 = $3 < $5\n";
-        cout << "slt $7, $5, $3\t\t\t\t\t; $7 = $5 < $3\n";
-        cout << "add $3, $6, $7\n";
-        cout << "sub $3, $11, $3\n";
-    }
-    if(left != right) {
-        cerr << "SomethingNotRight: expression comparison failed: cannnot compare type \"" 
-            << left << "\" with \""
-            << right << "\"" << endl;
+    Value left, right;
+    if(isPure(leftNode) && isPure(rightNode) && registerNeed(rightNode) > registerNeed(leftNode)) {
+        right = compileExpr(rightNode, function);
+        left = compileExpr(leftNode, function);
     }
+    else {
+        left = compileExpr(leftNode, function);
+        right = compileExpr(rightNode, function);
+    }
+
+    Opcode op = OP_EQ;
+    if(middle == "LT") op = OP_LT;
+    if(middle == "GT") op = OP_GT;
+    if(middle == "GE") op = OP_GE;
+    if(middle == "LE") op = OP_LE;
+    if(middle == "NE") op = OP_NE;
+    Value result = emit(op, INT, {left.id, right.id});
+    // pointers are compared as unsigned addresses
+    block->insts.back().isUnsigned = left.type == INT_STAR;
+    if(left.type != right.type) {
+        errors << "SomethingNotRight: expression comparison failed: cannnot compare type \"" 
+            << left.type << "\" with \""
+            << right.type << "\"" << endl;
+    }
+    return result;
 }
 
 /**
-* Compiles a factor and returns the type of the result.
+* Compiles a factor and returns the value it computes.
 * 
 * @param node - * pointer to the node that has to be compiled
 * @param function - name of the function that is being compiled
 * 
-* @return type of the result of the factor as it is
+* @return the value of the factor and its type
 */
-Type Compiler::compileFactor(Node *node, string function) {
-    if(node->children[0]->rule == "NULL") {
-        // cout << "lis $5\n";
-        // cout << ".word 0x01"
-        cout << "add $3, $0, $11\n";
-        // push(11);
-        return INT_STAR;
-    }
+Value Compiler::compileFactor(Node *node, string function) {
+    if(node->children[0]->rule == "NULL") return constant(1, INT_STAR);
     
     if(node->children[0]->rule == "NUM") {
-        constantGenerator(node->children[0]->children[0]->rule);
-        cout << "add $3, $5, $0\n";
-        return INT;
+        return constant(stoll(node->children[0]->children[0]->rule));
     }
     if(node->children[0]->rule == "STAR") {
-        Type left = compileFactor(node->children[1].get(), function);
-        cout << "lw $3, 0($3)\n";
-        if(left == INT_STAR) return INT;
-        else cerr << "SomethingNotRight: cannot use * with type \"INT\"" << endl;
+        Value address = compileFactor(node->children[1].get(), function);
+        if(address.type != INT_STAR) errors << "SomethingNotRight: cannot use * with type \"INT\"" << endl;
+        return emit(OP_LOAD, INT, {address.id});
     }
     if(node->children[0]->rule == "AMP") {
-        if(node->children[1]->children.size() == 1) {
-            cout << "lis $3\n";
-            string variable = node->children[1]->children[0]->children[0]->rule;
-            int offset = varOffset[function][variable];
-            cout << ".word " << offset << endl;
-            cout << "add $3, $3, $29\n";
-        }
-        if(compileLValue(node->children[1].get(), function) == INT)
-            return INT_STAR;
-        else cerr << "SomethingNotRight: cannot use & with type \"INT*\"" << endl;
+        Location location = compileLValue(node->children[1].get(), function);
+        if(location.type != INT) errors << "SomethingNotRight: cannot use & with type \"INT*\"" << endl;
+        if(location.slot >= 0) return emit(OP_ADDR, INT_STAR, {}, location.slot);
+        return {location.address, INT_STAR};
     }
     if(node->children[0]->rule == "LPAREN") return compileExpr(node->children[1].get(), function);
     
     if(node->children[0]->rule == "NEW") {
-        cout << ";   new\n";
-        if(compileExpr(node->children[3].get(), function) == INT) {
-            cout << " add $1, $3, $0\n";
-            push(31);
-            cout << "lis $5\n";
-            cout << ".word new\n";
-            cout << "jalr $5\n";
-            pop(31);
-            cout << "bne $3, $0, 1\n";
-            cout << "add $3, $11, $0\n";
-            return INT_STAR;
-        }
-        else cerr << "SomethingNotRight: \"new\" can only be used with type \"INT\"" << endl;
+        Value size = compileExpr(node->children[3].get(), function);
+        if(size.type != INT) errors << "SomethingNotRight: \"new\" can only be used with type \"INT\"" << endl;
+        return emit(OP_NEW, INT_STAR, {size.id});
     }
     if(node->children.size() == 1) {
         string variable = getIDValue(node->children[0].get());
         if(!variableExists(function, variable)) {
-            cerr << "SomethingNotRight: variable \""
+            errors << "SomethingNotRight: variable \""
             << variable << "\" not declared in function \"" << function << "\"" << endl;
+            return constant(0);
         }
-        // cerr << "func: " << variable << endl;
-        code(function, variable);
-        return variables[function][variable];
+        return emit(OP_SLOAD, variables[function][variable], {}, varSlot[function][variable]);
     }
+    string callingFunction = getIDValue(node->children[0].get());
+    vector<int> args;
     if(node->children.size() == 3) {
-        string callingFunction = getIDValue(node->children[0].get());
-        push(31);
-        push(29);
-        cout << "lis $5\n";
-        cout << ".word " << callingFunction << endl;
-        cout << "jalr $5\n";
-        pop(29);
-        pop(31);
         if(functionExists(callingFunction)) {
-            if(procedures[callingFunction].size() == 0) return INT;
-            else cerr << "SomethingNotRight: Wrong number of arguments passed to \"" << callingFunction
+            if(procedures[callingFunction].size() != 0)
+                errors << "SomethingNotRight: Wrong number of arguments passed to \"" << callingFunction
                 << "\"" << endl;
         }
-        else cerr << "SomethingNotRight: function \"" << callingFunction
+        else errors << "SomethingNotRight: function \"" << callingFunction
             << "\" not declared" << endl;
     }
-    if(node->children.size() == 4) {
-        string callingFunction = getIDValue(node->children[0].get());
-        push(29);
-        push(31);
-        Type retval = compileFunctionWithArgs(node, function);
-        cout << "lis $5\n";
-        cout << ".word " << callingFunction << endl;
-        cout << "jalr $5\n";
-        pop(31);
-        pop(29);
-
-        return retval;
-    }
+    if(node->children.size() == 4) compileFunctionWithArgs(node, function, args);
+    if(variableExists(function, callingFunction))
+        errors << "SomethingNotRight: \"" << callingFunction << "\" is a variable in function \""
+            << function << "\"" << endl;
+    Value result = emit(OP_CALL, INT, args);
+    block->insts.back().callee = callingFunction;
+    return result;
 }
 
 /**
@@ -615,47 +658,33 @@ Type Compiler::compileFactor(Node *node, string function) {
 * @param function - name of the function that is being compiled
 * @param numArgs - number of arguments in the list
 * @param callingFunction - name of the function that is calling the function
+* @param args - the values of the arguments compiled so far, in order
 * 
 * @return type of the first argument or null if there is
 */
-Type Compiler::compileArglist(Node *node, string function, int numArgs, string callingFunction) {
+Type Compiler::compileArglist(Node *node, string function, int numArgs, string callingFunction,
+        vector<int> &args) {
     if(!functionExists(callingFunction)) {
-        cerr << "SomethingNotRight: function \"" << callingFunction << "\" not declared" << endl;
+        errors << "SomethingNotRight: function \"" << callingFunction << "\" not declared" << endl;
+        return INT;
     }
-    else if((numArgs-1) >= procedures[callingFunction].size()) {
-        cerr << "SomethingNotRight: too many arguments passed to \"" << callingFunction
+    if((numArgs-1) >= procedures[callingFunction].size()) {
+        errors << "SomethingNotRight: too many arguments passed to \"" << callingFunction
                 << "\"" << endl;
+        return INT;
     }
-    else {
-        if(node->children.size() == 1) {
-            if((numArgs == 1)) {
-                if((numArgs) != procedures[callingFunction].size())
-                    cerr << "SomethingNotRight: too few arguments passed to \"" << callingFunction
-                    << "\"" << endl;
-            }
-
-            Type retval = compileExpr(node->children[0].get(), function);
-            push(3);
-            if(procedures[callingFunction][numArgs-1] != retval)
-            cerr << "SomethingNotRight: wrong type passed as arg to function: \"" << callingFunction
-                << "\"" << endl;
-            return INT; 
-        }
-        if(node->children.size() == 3) {
-            if((node->children[2]->children.size() == 1)) {
-                if((numArgs+1) != procedures[callingFunction].size())
-                    cerr << "SomethingNotRight: too few arguments passed to \"" << callingFunction
-                    << "\"" << endl;
-            }
-            Type retval = compileExpr(node->children[0].get(), function);
-            if(procedures[callingFunction][numArgs-1] != retval)
-            cerr << "SomethingNotRight: wrong type passed as arg to function: \"" << callingFunction
-                << "\"" << endl;
-            else {
-                return compileArglist(node->children[2].get(), function, numArgs+1, callingFunction);
-            }
-        }
+    Value retval = compileExpr(node->children[0].get(), function);
+    args.push_back(retval.id);
+    if(procedures[callingFunction][numArgs-1] != retval.type)
+        errors << "SomethingNotRight: wrong type passed as arg to function: \"" << callingFunction
+            << "\"" << endl;
+    if(node->children.size() == 1) {
+        if(numArgs != procedures[callingFunction].size())
+            errors << "SomethingNotRight: too few arguments passed to \"" << callingFunction
+            << "\"" << endl;
+        return INT;
     }
+    return compileArglist(node->children[2].get(), function, numArgs+1, callingFunction, args);
 }
 
 /**
@@ -663,14 +692,13 @@ Type Compiler::compileArglist(Node *node, string function, int numArgs, string c
 * 
 * @param node - * The node that contains the function to compile
 * @param function - The name of the function to compile
+* @param args - where the values of the arguments are stored
 * 
 * @return The type of the function with arguments
 */
-Type Compiler::compileFunctionWithArgs(Node *node, string function) {
+Type Compiler::compileFunctionWithArgs(Node *node, string function, vector<int> &args) {
     string callingFunction = getIDValue(node->children[0].get());
-    if(!functionExists(callingFunction)) cerr << "SomethingNotRight: function \"" << callingFunction
-        << "\" not declared" << endl;
-    return compileArglist(node->children[2].get(), function, 1, callingFunction);
+    return compileArglist(node->children[2].get(), function, 1, callingFunction, args);
 }
 
 /**
@@ -679,81 +707,79 @@ Type Compiler::compileFunctionWithArgs(Node *node, string function) {
 * @param node - * The node that is to be compiled.
 * @param function - The name of the function that is being compiled.
 * 
-* @return The type of the expression that is represented by the term
+* @return The value of the term and its type
 */
-Type Compiler::compileTerm(Node *node, string function) {
+Value Compiler::compileTerm(Node *node, string function) {
     if(node->children.size() == 1) 
         return compileFactor(node->children[0].get(), function);
-    if(node->children.size() == 3) {
-        Type left = compileTerm(node->children[0].get(), function);
-        push(3);
-        string middle = node->children[1]->rule;
-        Type right = compileFactor(node->children[2].get(), function);
-        pop(5);
-        if(middle == "STAR") {
-            cout << "mult $5, $3\n";
-            cout << "mflo $3\n";
-        }
-        if(middle == "SLASH") {
-            cout << "div $5, $3\n";
-            cout << "mflo $3\n";
-        }
-        if(middle == "PCT") {
-            cout << "div $5, $3\n";
-            cout << "mfhi $3\n";
-        }
-        if(left == right && left == INT) return INT;
-        cerr << "SomethingNotRight: cannot compare \"" << left
-            << "\" to \"" << right << "\"" << endl;
+    Node *leftNode = node->children[0].get();
+    Node *rightNode = node->children[2].get();
+    string middle = node->children[1]->rule;
+    Value left, right;
+    if(isPure(leftNode) && isPure(rightNode) && registerNeed(rightNode) > registerNeed(leftNode)) {
+        right = compileFactor(rightNode, function);
+        left = compileTerm(leftNode, function);
+    }
+    else {
+        left = compileTerm(leftNode, function);
+        right = compileFactor(rightNode, function);
+    }
+    if(left.type != INT || right.type != INT) {
+        errors << "SomethingNotRight: cannot compare \"" << left.type
+            << "\" to \"" << right.type << "\"" << endl;
     }
+    Opcode op = OP_MUL;
+    if(middle == "SLASH") op = OP_DIV;
+    if(middle == "PCT") op = OP_REM;
+    return emit(op, INT, {left.id, right.id});
 }
 
 /**
-* Compiles an expression and returns the type of the result. 
+* Compiles an expression and returns the value it computes.
 * 
 * @param node - The node to compile.
 * @param function - The function to compile.
 * 
-* @return The type of the result of the expression. 
+* @return The value of the expression and its type
 */
-Type Compiler::compileExpr(Node *node, string function) {
-    if(node->children.size() == 1) {
-        Type retval = compileTerm(node->children[0].get(), function);
-        return retval;
-    }
-    if(node->children.size() == 3) {
-        string middle = node->children[1]->rule;
-        Type left = compileExpr(node->children[0].get(), function);
-        push(3);
-        Type right = compileTerm(node->children[2].get(), function);
-        pop(5);
-        if(left == INT && right == INT) {
-            if(middle == "PLUS") cout << "add $3, $5, $3\n";
-            if(middle == "MINUS") cout << "sub $3, $5, $3\n";
-            return INT;
-        }
-        if(left == INT_STAR && right == INT) {
-            cout << "mult $3, $4\n";
-            cout << "mflo $3\n";
-            if(middle == "PLUS") cout << "add $3, $5, $3\n";
-            if(middle == "MINUS") cout << "sub $3, $5, $3\n";
-            return INT_STAR;
-        }
-        if(left == INT && right == INT_STAR) {
-            cout << "mult $5, $4\n";
-            cout << "mflo $5\n";
-            if(middle == "PLUS") cout << "add $3, $5, $3\n";
-            return INT_STAR;
-        }
-        if(left == INT_STAR && right == INT_STAR && middle == "MINUS") {
-            cout << "sub $3, $5, $3\n";
-            cout << " div $3, $4\n";
-            cout << "mflo $3\n";
-            return INT;
-        }
-        // if(left == INT && right == INT_STAR && middle == "PLUS") return INT_STAR;
-        // if(left == INT && right == INT) return INT;
-        cerr << "SomethingNotRight: expression comparison invalid" << endl;
+Value Compiler::compileExpr(Node *node, string function) {
+    if(node->children.size() == 1) return compileTerm(node->children[0].get(), function);
+
+    Node *leftNode = node->children[0].get();
+    Node *rightNode = node->children[2].get();
+    string middle = node->children[1]->rule;
+    Value left, right;
+    int afterLeft, afterRight;
+    if(isPure(leftNode) && isPure(rightNode) && registerNeed(rightNode) > registerNeed(leftNode)) {
+        right = compileTerm(rightNode, function);
+        afterRight = block->insts.size();
+        left = compileExpr(leftNode, function);
+        afterLeft = block->insts.size();
     }
-    
-}
\ No newline at end of file
+    else {
+        left = compileExpr(leftNode, function);
+        afterLeft = block->insts.size();
+        right = compileTerm(rightNode, function);
+        afterRight = block->insts.size();
+    }
+    Opcode op = middle == "PLUS" ? OP_ADD : OP_SUB;
+    if(left.type == INT && right.type == INT) return emit(op, INT, {left.id, right.id});
+    if(left.type == INT_STAR && right.type == INT) {
+        Value scaled = scale(right, afterRight);
+        return emit(op, INT_STAR, {left.id, scaled.id});
+    }
+    if(left.type == INT && right.type == INT_STAR && middle == "PLUS") {
+        Value scaled = scale(left, afterLeft);
+        return emit(OP_ADD, INT_STAR, {scaled.id, right.id});
+    }
+    if(left.type == INT_STAR && right.type == INT_STAR && middle == "MINUS") {
+        Value difference = emit(OP_SUB, INT, {left.id, right.id});
+        Value four = constant(4);
+        Value quotient = emit(OP_DIV, INT, {difference.id, four.id});
+        // both point into the same array, so they are a whole number of words apart
+        block->insts.back().isExact = true;
+        return quotient;
+    }
+    errors << "SomethingNotRight: expression comparison invalid" << endl;
+    return emit(op, INT, {left.id, right.id});
+}
@@ -2,52 +2,83 @@
 #define WLP4GEN_H
 
 #include "tree.h"
-#include <map>
+#include "ir.h"
 #include <map>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <sstream>
 using namespace std;
 
-enum Type {
-    INT=0, INT_STAR,
+// The IR value an expression was compiled to, with its WLP4 type.
+struct Value {
+    int id;
+    Type type;
+};
+
+// Where an assignment stores to: the slot of a variable, or the address held in a value.
+struct Location {
+    // -1 when the location is *address
+    int slot;
+    int address;
+    Type type;
 };
 
 class Compiler {
 	public:
 		void compile(Node*);
+		Module &getModule();
 		void printVariableTable();
-		void generatePrologue(string);
-		void generateEpilogue(string);
+		void setThreads(int);
 	private:
-		int labelCount = 0;
+		Module module;
+		// diagnostics, printed in source order once every body is compiled
+		stringstream errors;
+		int threads = 1;
+		Function *current = nullptr;
+		Block *block = nullptr;
+		// blocks of the current function in the order they were filled
+		vector<Block*> layout;
 		// fnName,        [arglist]
 		map<string, vector<Type>> procedures;
+		// fnName,  position in the source; a procedure can only call those declared before it
+		map<string, int> declared;
+		// position of the procedure being compiled
+		int index = 0;
 		// fnName,      varName, varType
 		map<string, map<string, Type>> variables;
-		map<string, map<string, int>> varOffset;
+		map<string, map<string, int>> varSlot;
 		map<string, vector<string>> varOrder;
-	
+
+		void collectProcedures(Node*, vector<Node*>&);
+		void declareProcedure(Node*, int);
+		void declareParams(Node*, string);
 		void compileMain(Node*);
 		void compileProcedure(Node*);
 		void compileDcl(Node*, string, bool);
 		void compileDcls(Node*, string);
 		void compileStatements(Node*, string);
-		void compileTest(Node*, string);
+		Value compileTest(Node*, string);
 		void compileParams(Node*, string);
-		Type compileExpr(Node*, string);
-		Type compileTerm(Node*, string);
-		Type compileFactor(Node*, string);
-		Type compileLValue(Node*, string);
-		Type compileFunctionWithArgs(Node*, string);
-		Type compileArglist(Node*, string, int, string);
-		
-		void makeOffsetTable(string);
-		void code(string, string);
-		void push(int);
-		void pop(int);
-		void constantGenerator(string);
-		string getUniqueLabel(string);
+		Value compileExpr(Node*, string);
+		Value compileTerm(Node*, string);
+		Value compileFactor(Node*, string);
+		Location compileLValue(Node*, string);
+		Type compileFunctionWithArgs(Node*, string, vector<int>&);
+		Type compileArglist(Node*, string, int, string, vector<int>&);
+
+		void beginFunction(string);
+		void endFunction();
+		void declareVariable(string, string, Type, int);
+		void setBlock(Block*);
+		Value emit(Opcode, Type, vector<int>, int = 0);
+		void emitEffect(Opcode, vector<int>, int = 0);
+		void emitBranch(Opcode, vector<int>, vector<Block*>);
+		Value constant(int, Type = INT);
+		Value scale(Value, int);
+
+		int registerNeed(Node*);
+		bool isPure(Node*);
 
 		Type getType(Node*);
 		string getIDValue(Node*);